@@ -0,0 +1,297 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "libfreenect_registration.h"
+#include "baseplane.h"
+
+#define BASEPLANE_X 640
+#define BASEPLANE_Y 480
+#define RANSAC_ITERATIONS 256
+#define RANSAC_SAMPLE_POINTS 4096	//points each candidate plane is scored against
+#define RANSAC_TOLERANCE_MM 8.0f
+#define MIN_POINTS 1000
+#define MIN_INLIER_FRACTION 0.2f
+//a typical Kinect's zero plane, for calibrating without one
+#define DEFAULT_REF_PIXEL_MM 0.1042
+#define DEFAULT_REF_DISTANCE_MM 120.0
+
+int baseplane_init(baseplane_t * bp) {
+	bp->valid = 0;
+	bp->inliers = 0;
+	bp->gain = (float *)malloc(BASEPLANE_X * BASEPLANE_Y * sizeof(float));
+	return bp->gain == NULL ? -1 : 0;
+}
+
+void baseplane_free(baseplane_t * bp) {
+	free(bp->gain);
+	bp->gain = NULL;
+	bp->valid = 0;
+}
+
+//eigenvector of the smallest eigenvalue of a symmetric 3x3 matrix, by cyclic Jacobi rotations
+static void smallest_eigenvector(double a[3][3], double out[3]) {
+	double v[3][3] = {{1,0,0},{0,1,0},{0,0,1}};
+	int sweep, p, q, k, best;
+
+	for(sweep=0;sweep<32;sweep++) {
+		double off = a[0][1]*a[0][1] + a[0][2]*a[0][2] + a[1][2]*a[1][2];
+		if(off < 1e-18) {
+			break;
+		}
+		for(p=0;p<2;p++) {
+			for(q=p+1;q<3;q++) {
+				double theta, t, c, s;
+				if(fabs(a[p][q]) < 1e-30) {
+					continue;
+				}
+				theta = (a[q][q] - a[p][p]) / (2*a[p][q]);
+				t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta*theta + 1));
+				c = 1 / sqrt(t*t + 1);
+				s = t*c;
+				for(k=0;k<3;k++) {
+					double akp = a[k][p], akq = a[k][q];
+					a[k][p] = c*akp - s*akq;
+					a[k][q] = s*akp + c*akq;
+				}
+				for(k=0;k<3;k++) {
+					double apk = a[p][k], aqk = a[q][k];
+					a[p][k] = c*apk - s*aqk;
+					a[q][k] = s*apk + c*aqk;
+				}
+				for(k=0;k<3;k++) {
+					double vkp = v[k][p], vkq = v[k][q];
+					v[k][p] = c*vkp - s*vkq;
+					v[k][q] = s*vkp + c*vkq;
+				}
+			}
+		}
+	}
+	best = 0;
+	for(k=1;k<3;k++) {
+		if(a[k][k] < a[best][best]) {
+			best = k;
+		}
+	}
+	for(k=0;k<3;k++) {
+		out[k] = v[k][best];
+	}
+}
+
+//the camera's raw -> mm table and viewing rays, from its registration or, without one, a typical Kinect's
+static void camera_tables(baseplane_t * bp, freenect_device * dev) {
+	freenect_registration reg;
+	int i, x, y;
+
+	if(dev == NULL) {
+		//the usual fit of raw disparity to distance, and rays as freenect_camera_to_world has them
+		double factor = 2 * DEFAULT_REF_PIXEL_MM / DEFAULT_REF_DISTANCE_MM;
+		for(i=0;i<2048;i++) {
+			float z = 123.6f * tanf(i / 2842.5f + 1.1863f);
+			bp->mm[i] = (i < 2047 && z > 0 && z < 10000.0f) ? z : 0;
+		}
+		for(x=0;x<BASEPLANE_X;x++) {
+			bp->ray_x[x] = (float)((x - BASEPLANE_X/2) * factor);
+		}
+		for(y=0;y<BASEPLANE_Y;y++) {
+			bp->ray_y[y] = (float)((y - BASEPLANE_Y/2) * factor);
+		}
+		return;
+	}
+	reg = freenect_copy_registration(dev);
+	for(i=0;i<2048;i++) {
+		bp->mm[i] = reg.raw_to_mm_shift != NULL ? reg.raw_to_mm_shift[i] : 0;
+	}
+	freenect_destroy_registration(&reg);
+	for(x=0;x<BASEPLANE_X;x++) {
+		double wx, wy;
+		freenect_camera_to_world(dev, x, 0, 1000, &wx, &wy);
+		bp->ray_x[x] = (float)(wx / 1000);
+	}
+	for(y=0;y<BASEPLANE_Y;y++) {
+		double wx, wy;
+		freenect_camera_to_world(dev, 0, y, 1000, &wx, &wy);
+		bp->ray_y[y] = (float)(wy / 1000);
+	}
+}
+
+//fits the floor plane to one raw depth frame of the empty sandbox and rebuilds the height tables
+//RANSAC over the mm point cloud finds the dominant plane, a least squares fit over its inliers refines it
+//dev NULL calibrates with a typical Kinect's tables, for synthetic frames
+//returns the number of inliers, or -1 if no plane was found (the previous calibration is kept)
+int baseplane_calibrate(baseplane_t * bp, freenect_device * dev, const uint16_t * raw) {
+	float * pts;
+	float best[4] = {0, 0, 0, 0};
+	int best_score = 0;
+	uint32_t seed = 0x9e3779b9;
+	double centroid[3] = {0, 0, 0};
+	double cov[3][3] = {{0,0,0},{0,0,0},{0,0,0}};
+	double normal[3];
+	double d;
+	int n, stride, it, i, k, x, y, inliers;
+
+	camera_tables(bp, dev);
+	pts = (float *)malloc(BASEPLANE_X * BASEPLANE_Y * 3 * sizeof(float));
+	if(pts == NULL) {
+		return -1;
+	}
+	//the point cloud along the same rays the height tables use, pixels without a reading left out
+	n = 0;
+	for(y=0;y<BASEPLANE_Y;y++) {
+		for(x=0;x<BASEPLANE_X;x++) {
+			float z = bp->mm[raw[y*BASEPLANE_X + x] & 2047];
+			if(z > 0) {
+				pts[3*n] = bp->ray_x[x] * z;
+				pts[3*n+1] = bp->ray_y[y] * z;
+				pts[3*n+2] = z;
+				n++;
+			}
+		}
+	}
+	if(n < MIN_POINTS) {
+		free(pts);
+		return -1;
+	}
+
+	stride = n / RANSAC_SAMPLE_POINTS + 1;
+	for(it=0;it<RANSAC_ITERATIONS;it++) {
+		float * p[3];
+		float u[3], v[3], c[4], len;
+		int score = 0;
+
+		for(k=0;k<3;k++) {
+			//xorshift32, repeatable from run to run
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			p[k] = pts + 3*(seed % n);
+		}
+		for(k=0;k<3;k++) {
+			u[k] = p[1][k] - p[0][k];
+			v[k] = p[2][k] - p[0][k];
+		}
+		c[0] = u[1]*v[2] - u[2]*v[1];
+		c[1] = u[2]*v[0] - u[0]*v[2];
+		c[2] = u[0]*v[1] - u[1]*v[0];
+		len = sqrtf(c[0]*c[0] + c[1]*c[1] + c[2]*c[2]);
+		if(len < 1e-3f) {
+			continue;
+		}
+		c[0] /= len;
+		c[1] /= len;
+		c[2] /= len;
+		c[3] = -(c[0]*p[0][0] + c[1]*p[0][1] + c[2]*p[0][2]);
+		for(i=0;i<n;i+=stride) {
+			float * q = pts + 3*i;
+			score += fabsf(c[0]*q[0] + c[1]*q[1] + c[2]*q[2] + c[3]) < RANSAC_TOLERANCE_MM;
+		}
+		if(score > best_score) {
+			best_score = score;
+			for(k=0;k<4;k++) {
+				best[k] = c[k];
+			}
+		}
+	}
+	if(best_score == 0) {
+		free(pts);
+		return -1;
+	}
+
+	inliers = 0;
+	for(i=0;i<n;i++) {
+		float * q = pts + 3*i;
+		if(fabsf(best[0]*q[0] + best[1]*q[1] + best[2]*q[2] + best[3]) < RANSAC_TOLERANCE_MM) {
+			for(k=0;k<3;k++) {
+				centroid[k] += q[k];
+			}
+			inliers++;
+		}
+	}
+	if(inliers < MIN_INLIER_FRACTION * n) {
+		free(pts);
+		return -1;
+	}
+	for(k=0;k<3;k++) {
+		centroid[k] /= inliers;
+	}
+	for(i=0;i<n;i++) {
+		float * q = pts + 3*i;
+		if(fabsf(best[0]*q[0] + best[1]*q[1] + best[2]*q[2] + best[3]) < RANSAC_TOLERANCE_MM) {
+			double e[3] = {q[0] - centroid[0], q[1] - centroid[1], q[2] - centroid[2]};
+			for(k=0;k<3;k++) {
+				cov[k][0] += e[k]*e[0];
+				cov[k][1] += e[k]*e[1];
+				cov[k][2] += e[k]*e[2];
+			}
+		}
+	}
+	free(pts);
+
+	smallest_eigenvector(cov, normal);
+	d = -(normal[0]*centroid[0] + normal[1]*centroid[1] + normal[2]*centroid[2]);
+	//point the normal at the camera (the origin), so sand piled up reads positive
+	if(d < 0) {
+		for(k=0;k<3;k++) {
+			normal[k] = -normal[k];
+		}
+		d = -d;
+	}
+	for(k=0;k<3;k++) {
+		bp->normal[k] = (float)normal[k];
+	}
+	bp->offset = (float)d;
+	for(y=0;y<BASEPLANE_Y;y++) {
+		for(x=0;x<BASEPLANE_X;x++) {
+			bp->gain[y*BASEPLANE_X + x] = bp->normal[0]*bp->ray_x[x] + bp->normal[1]*bp->ray_y[y] + bp->normal[2];
+		}
+	}
+	bp->inliers = inliers;
+	bp->valid = 1;
+	return inliers;
+}
+
+//raw 11 bit depth -> signed height above the base plane in mm, BASEPLANE_NO_HEIGHT where there is no reading
+//one table lookup and one multiply-add per pixel
+void baseplane_height(const baseplane_t * bp, const uint16_t * restrict raw, int16_t * restrict height) {
+	baseplane_height_run(bp, raw, height, 0, BASEPLANE_X*BASEPLANE_Y);
+}
+
+//as baseplane_height, for the count pixels from first on
+void baseplane_height_run(const baseplane_t * bp, const uint16_t * restrict raw, int16_t * restrict height, int first, int count) {
+	const float * restrict gain = bp->gain;
+	const float * mm = bp->mm;
+	float offset = bp->offset;
+	int i;
+
+	for(i=first;i<first+count;i++) {
+		float z = mm[raw[i] & 2047];
+		float h = z * gain[i] + offset;
+		h = h > 32767.0f ? 32767.0f : (h < -32767.0f ? -32767.0f : h);
+		height[i] = z > 0 ? (int16_t)lrintf(h) : BASEPLANE_NO_HEIGHT;
+	}
+}
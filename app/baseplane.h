@@ -0,0 +1,54 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "libfreenect.h"
+
+#define BASEPLANE_NO_HEIGHT INT16_MIN
+
+/** baseplane_t
+	The empty sandbox floor, fitted once, and the tables that turn raw depth
+	into signed height above it in mm (positive towards the camera).
+	height = mm[raw] * gain[pixel] + offset, where gain is the plane normal
+	dotted with the pixel's viewing ray.
+**/
+typedef struct {
+	int valid;
+	int inliers;
+	float normal[3];
+	float offset;
+	float mm[2048];	//raw 11 bit depth -> mm, 0 for no reading
+	float ray_x[640];	//viewing ray of each column, x/z
+	float ray_y[480];	//viewing ray of each row, y/z
+	float * gain;	//640*480 per pixel factors
+} baseplane_t;
+
+int baseplane_init(baseplane_t *);
+void baseplane_free(baseplane_t *);
+int baseplane_calibrate(baseplane_t *, freenect_device *, const uint16_t *);
+void baseplane_height(const baseplane_t *, const uint16_t *, int16_t *);
+void baseplane_height_run(const baseplane_t *, const uint16_t *, int16_t *, int, int);
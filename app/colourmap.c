@@ -0,0 +1,328 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "colourmap.h"
+
+//the original topography ramp: white, red, yellow, green, cyan, blue, black
+static const uint8_t default_ramp[7][3] = {
+	{255, 255, 255},
+	{255, 0, 0},
+	{255, 255, 0},
+	{0, 255, 0},
+	{0, 255, 255},
+	{0, 0, 255},
+	{0, 0, 0}
+};
+
+void colourmap_default_palette(colour_palette_t * pal) {
+	int c;
+	pal->count = 7;
+	for(c=0;c<7;c++) {
+		memcpy(pal->rgb[c], default_ramp[c], 3);
+		pal->weight[c] = 1.0f;
+	}
+}
+
+//reads "weight r g b" lines into pal, returns the number of colours or -1
+//pal is left untouched unless the file holds a usable palette (two or more colours)
+int colourmap_load_palette(colour_palette_t * pal, const char * path) {
+	FILE * colour_init;
+	colour_palette_t tmp;
+	float total_weight = 0;
+	int r, g, b;
+	int c;
+
+	colour_init = fopen(path, "r");
+	if(colour_init == NULL) {
+		return -1;
+	}
+	tmp.count = 0;
+	while(tmp.count < COLOURMAP_PALETTE_CAP
+		&& fscanf(colour_init, "%f %d %d %d", &tmp.weight[tmp.count], &r, &g, &b) == 4) {
+		tmp.rgb[tmp.count][0] = (uint8_t)(r < 0 ? 0 : (r > 255 ? 255 : r));
+		tmp.rgb[tmp.count][1] = (uint8_t)(g < 0 ? 0 : (g > 255 ? 255 : g));
+		tmp.rgb[tmp.count][2] = (uint8_t)(b < 0 ? 0 : (b > 255 ? 255 : b));
+		if(tmp.weight[tmp.count] < 0) {
+			tmp.weight[tmp.count] = 0;
+		}
+		tmp.count++;
+	}
+	fclose(colour_init);
+
+	for(c=0;c<tmp.count-1;c++) {
+		total_weight += tmp.weight[c];
+	}
+	if(tmp.count < 2 || total_weight <= 0) {
+		return -1;
+	}
+	*pal = tmp;
+	return tmp.count;
+}
+
+//ramp positions where each gradient starts, bound[c+1] is where gradient c ends
+//rounded from the cumulative weight so no position is left out
+static void ramp_bounds(const colour_palette_t * pal, int span, int * bound) {
+	float total_weight = 0;
+	float cum = 0;
+	int c;
+
+	for(c=0;c<pal->count-1;c++) {
+		total_weight += pal->weight[c];
+	}
+	bound[0] = 0;
+	for(c=0;c<pal->count-1;c++) {
+		cum += pal->weight[c];
+		bound[c+1] = (c == pal->count-2) ? span : (int)lroundf(cum / total_weight * span);
+	}
+}
+
+//32.32 fixed point step of channel ch along gradient c, len positions long
+static inline int64_t ramp_step(const colour_palette_t * pal, int c, int len, int ch) {
+	int64_t span_v = (int64_t)(pal->rgb[c+1][ch] - pal->rgb[c][ch]) << 32;
+	return len > 1 ? span_v / (len - 1) : 0;
+}
+
+//32.32 fixed point value of channel ch at position k of gradient c
+//the half rounds to nearest, the gradient meets its end colour exactly
+static inline int64_t ramp_start(const colour_palette_t * pal, int c, int64_t step, int k, int ch) {
+	return ((int64_t)pal->rgb[c][ch] << 32) + step * k + ((int64_t)1 << 31);
+}
+
+//writes positions [from, to) of the palette stretched over span positions, one every step slots of out
+//each gradient is stepped in 32.32 fixed point, so there is no search or division per slot
+static void ramp_fill(uint32_t * out, int step, int span, int from, int to, const colour_palette_t * pal) {
+	int bound[COLOURMAP_PALETTE_CAP];
+	int c, ch, p;
+
+	ramp_bounds(pal, span, bound);
+	for(c=0;c<pal->count-1;c++) {
+		int s0 = bound[c] > from ? bound[c] : from;
+		int s1 = bound[c+1] < to ? bound[c+1] : to;
+		int len = bound[c+1] - bound[c];
+		int64_t v[3], dv[3];
+
+		if(s0 >= s1) {
+			continue;
+		}
+		for(ch=0;ch<3;ch++) {
+			dv[ch] = ramp_step(pal, c, len, ch);
+			v[ch] = ramp_start(pal, c, dv[ch], s0 - bound[c], ch);
+		}
+		for(p=s0;p<s1;p++) {
+			*out = (uint32_t)(v[0] >> 32) | (uint32_t)(v[1] >> 32) << 8 | (uint32_t)(v[2] >> 32) << 16;
+			out += step;
+			v[0] += dv[0];
+			v[1] += dv[1];
+			v[2] += dv[2];
+		}
+	}
+}
+
+//the whole palette over size slots of out, first colour first
+void colourmap_ramp(uint32_t * out, int size, const colour_palette_t * pal) {
+	ramp_fill(out, 1, size, 0, size, pal);
+}
+
+//fills cm so that lut[d] is the palette colour at ramp position gamma[d], as colourmap_ramp has it
+//the palette is stretched over ramp positions [0, span), positions from span on are black
+void colourmap_build(colourmap_t * cm, const uint16_t * gamma, int span, const colour_palette_t * pal) {
+	int bound[COLOURMAP_PALETTE_CAP];
+	int c, ch, d;
+
+	ramp_bounds(pal, span, bound);
+	for(d=0;d<COLOURMAP_SIZE;d++) {
+		int pos = gamma[d];
+		int len, k;
+		uint32_t packed = 0;
+
+		if(pos >= span) {
+			cm->lut[d] = 0;
+			continue;
+		}
+		//empty (zero weight) segments are skipped over
+		for(c=0;pos>=bound[c+1];c++);
+		len = bound[c+1] - bound[c];
+		k = pos - bound[c];
+		for(ch=0;ch<3;ch++) {
+			packed |= (uint32_t)(ramp_start(pal, c, ramp_step(pal, c, len, ch), k, ch) >> 32) << (8*ch);
+		}
+		cm->lut[d] = packed;
+	}
+}
+
+#define DEPTH_SLOT(d) ((d) & (COLOURMAP_SIZE-1))
+
+//four pixels at a time are gathered from the table and shuffled into three 32 bit stores
+#define COLOURMAP_LOOP(table, src, SLOT) do { \
+	const uint32_t * lut = (table); \
+	int i = 0; \
+	COLOURMAP_LOOP4(src, SLOT) \
+	for(;i<count;i++) { \
+		uint32_t p = lut[SLOT(src[i])]; \
+		rgb[3*i+0] = (uint8_t)p; \
+		rgb[3*i+1] = (uint8_t)(p >> 8); \
+		rgb[3*i+2] = (uint8_t)(p >> 16); \
+	} \
+} while(0)
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define COLOURMAP_LOOP4(src, SLOT) \
+	for(;i+4<=count;i+=4) { \
+		uint32_t p0 = lut[SLOT(src[i+0])]; \
+		uint32_t p1 = lut[SLOT(src[i+1])]; \
+		uint32_t p2 = lut[SLOT(src[i+2])]; \
+		uint32_t p3 = lut[SLOT(src[i+3])]; \
+		uint32_t w[3]; \
+		w[0] = p0 | (p1 << 24); \
+		w[1] = (p1 >> 8) | (p2 << 16); \
+		w[2] = (p2 >> 16) | (p3 << 8); \
+		memcpy(rgb + 3*i, w, 12); \
+	}
+#else
+#define COLOURMAP_LOOP4(src, SLOT)
+#endif
+
+//colourizes count raw depth pixels into packed 8 bit RGB
+void colourmap_apply(const colourmap_t * cm, const uint16_t * depth, uint8_t * rgb, int count) {
+	COLOURMAP_LOOP(cm->lut, depth, DEPTH_SLOT);
+}
+
+//allocates size slots over domain values from origin, 1 << shift values to a slot
+//returns -1 if the table can't be allocated
+int colour_lut_init(colour_lut_t * cl, colourmap_domain domain, int32_t origin, int size, int shift) {
+	cl->domain = domain;
+	cl->origin = origin;
+	cl->shift = shift;
+	cl->size = size;
+	cl->lut = (uint32_t *)calloc(size, sizeof(uint32_t));
+	return cl->lut == NULL ? -1 : 0;
+}
+
+void colour_lut_free(colour_lut_t * cl) {
+	free(cl->lut);
+	cl->lut = NULL;
+}
+
+//slot of a domain value, unclamped, rounding down for values below the origin
+static inline int64_t lut_slot(const colour_lut_t * cl, int64_t v) {
+	return (v - cl->origin) >> cl->shift;
+}
+
+//lays the palette over cl: the first colour at domain value first, the last at value last
+//first may be above last, for palettes that run downwards
+//values beyond either end are black, or the colour at that end if extend is set
+void colour_lut_build(colour_lut_t * cl, const colour_palette_t * pal, int32_t first, int32_t last, int extend) {
+	int64_t a = lut_slot(cl, first);
+	int64_t b = lut_slot(cl, last);
+	int64_t lo = a < b ? a : b;
+	int64_t hi = a < b ? b : a;
+	int64_t span = hi - lo + 1;
+	int top = cl->size - 1;
+	int from = lo > 0 ? (lo < top ? (int)lo : top) : 0;
+	int to = hi + 1 < top ? (int)(hi + 1) : top;
+	int64_t no_reading = 0;
+	uint32_t low_colour = 0;
+	uint32_t high_colour = 0;
+	int i;
+
+	if(span > INT32_MAX) {
+		span = INT32_MAX;
+	}
+	if(from < to) {
+		if(a <= b) {
+			ramp_fill(cl->lut + from, 1, (int)span, (int)(from - lo), (int)(to - lo), pal);
+		} else {
+			//the first colour sits at hi, so the ramp is written downwards from the top visible slot
+			ramp_fill(cl->lut + to - 1, -1, (int)span, (int)(hi + 1 - to), (int)(hi + 1 - from), pal);
+		}
+	}
+	if(extend) {
+		int last_c = pal->count - 1;
+		uint32_t first_colour = pal->rgb[0][0] | pal->rgb[0][1] << 8 | pal->rgb[0][2] << 16;
+		uint32_t last_colour = pal->rgb[last_c][0] | pal->rgb[last_c][1] << 8 | pal->rgb[last_c][2] << 16;
+		low_colour = a <= b ? first_colour : last_colour;
+		high_colour = a <= b ? last_colour : first_colour;
+	}
+	for(i=0;i<from;i++) {
+		cl->lut[i] = low_colour;
+	}
+	for(i=to;i<top;i++) {
+		cl->lut[i] = high_colour;
+	}
+	cl->lut[top] = 0;
+
+	switch(cl->domain) {
+	case COLOURMAP_DOMAIN_RAW:
+		no_reading = 2047;
+		break;
+	case COLOURMAP_DOMAIN_MM:
+		no_reading = 0;
+		break;
+	case COLOURMAP_DOMAIN_HEIGHT:
+		no_reading = INT16_MIN;	//BASEPLANE_NO_HEIGHT
+		break;
+	}
+	no_reading = lut_slot(cl, no_reading);
+	if(no_reading >= 0 && no_reading < top) {
+		cl->lut[no_reading] = 0;
+	}
+}
+
+#define DIRECT_SLOT(v) (v)
+//any value off the table lands on the last slot; unsigned, so values below the origin wrap past it
+#define LUT_SLOT(v) lut_clamp(((uint32_t)((int32_t)(v) - origin)) >> shift, top)
+
+static inline uint32_t lut_clamp(uint32_t slot, uint32_t top) {
+	return slot < top ? slot : top;
+}
+
+//colourizes count raw or mm pixels into packed 8 bit RGB
+void colour_lut_apply(const colour_lut_t * cl, const uint16_t * values, uint8_t * rgb, int count) {
+	int32_t origin = cl->origin;
+	int shift = cl->shift;
+	uint32_t top = cl->size - 1;
+
+	if(origin == 0 && shift == 0 && cl->size == COLOURMAP_MM_SIZE) {
+		//every 16 bit value has its own slot
+		COLOURMAP_LOOP(cl->lut, values, DIRECT_SLOT);
+	} else {
+		COLOURMAP_LOOP(cl->lut, values, LUT_SLOT);
+	}
+}
+
+//as colour_lut_apply, for signed heights in mm
+void colour_lut_apply_height(const colour_lut_t * cl, const int16_t * height, uint8_t * rgb, int count) {
+	int32_t origin = cl->origin;
+	int shift = cl->shift;
+	uint32_t top = cl->size - 1;
+
+	COLOURMAP_LOOP(cl->lut, height, LUT_SLOT);
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define COLOURMAP_SIZE 2048
+#define COLOURMAP_PALETTE_CAP 16
+#define COLOURMAP_HEIGHT_ZERO 1024	//slot of 0 mm in 2048 slot height tables, as the DEM raster holds them
+#define COLOURMAP_MM_SIZE 65536		//slots of a colour_lut_t indexed directly by 16 bit mm
+
+/** colour_palette_t
+	Breakpoint colours with gradient weights, as read from colour.init.
+	weight[c] is the share of the ramp spent going from colour c to colour c+1,
+	the weight of the last colour is unused.
+**/
+typedef struct {
+	int count;
+	uint8_t rgb[COLOURMAP_PALETTE_CAP][3];
+	float weight[COLOURMAP_PALETTE_CAP];
+} colour_palette_t;
+
+/** colourmap_t
+	Every raw 11 bit depth value mapped to a colour, packed as r | g<<8 | b<<16.
+	Values the ramp does not reach (including 2047, no reading) are black.
+**/
+typedef struct {
+	uint32_t lut[COLOURMAP_SIZE];
+} colourmap_t;
+
+typedef enum {
+	COLOURMAP_DOMAIN_RAW,		//11 bit disparity, 2047 is no reading
+	COLOURMAP_DOMAIN_MM,		//distance in mm, 0 is no reading
+	COLOURMAP_DOMAIN_HEIGHT		//signed mm above the base plane, BASEPLANE_NO_HEIGHT is no reading
+} colourmap_domain;
+
+/** colour_lut_t
+	A palette laid over a stretch of one depth domain, packed as in colourmap_t.
+	Slot s holds domain values origin + (s << shift) up to the next slot, so the
+	shift sets the resolution. The last slot is black, it takes the values off
+	the table as well as the domain's no reading value.
+	With origin 0, shift 0 and COLOURMAP_MM_SIZE slots, 16 bit mm index it directly.
+**/
+typedef struct {
+	colourmap_domain domain;
+	int32_t origin;
+	int shift;
+	int size;
+	uint32_t * lut;
+} colour_lut_t;
+
+void colourmap_default_palette(colour_palette_t *);
+int colourmap_load_palette(colour_palette_t *, const char *);
+void colourmap_build(colourmap_t *, const uint16_t *, int, const colour_palette_t *);
+void colourmap_apply(const colourmap_t *, const uint16_t *, uint8_t *, int);
+void colourmap_ramp(uint32_t *, int, const colour_palette_t *);
+
+int colour_lut_init(colour_lut_t *, colourmap_domain, int32_t, int, int);
+void colour_lut_free(colour_lut_t *);
+void colour_lut_build(colour_lut_t *, const colour_palette_t *, int32_t, int32_t, int);
+void colour_lut_apply(const colour_lut_t *, const uint16_t *, uint8_t *, int);
+void colour_lut_apply_height(const colour_lut_t *, const int16_t *, uint8_t *, int);
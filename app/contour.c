@@ -39,6 +39,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
 
 //opengl/openkinect
 #include "libfreenect.h"
@@ -53,19 +55,39 @@
 #include <math.h>
 
 
+#include "colourmap.h"
 #include "contour.h"
+#include "spatial.h"
+#include "headless.h"
+#include "workers.h"
+#include "isolines.h"
+#include "vectorsink.h"
+#include "tiles.h"
+#include "occlusion.h"
 
 //default vals
 #define DEFAULT_WINDOW_X 640
 #define DEFAULT_WINDOW_Y 480
 #define DEFAULT_WINDOW_TITLE "OSX Contour"
 #define DEFAULT_INIT_PATH "colour.init"
+#define DEFAULT_CONFIG_PATH "contour.cfg"
 #define DEFAULT_LINE_BUFFER_BYTES 100
-#define DEFAULT_COLOUR_CAP 16
+#define DEFAULT_CONTOUR_START 500
+#define DEFAULT_CONTOUR_RANGE 250
+#define DEFAULT_CONTOUR_BANDS 25
+//band labels are a byte and 255 marks depths outside the range
+#define MAX_CONTOUR_BANDS 254
+//raw depth moved by one press of the range keys
+#define DEFAULT_RANGE_STEP 10
+//smoothing after hole filling, see spatial.h; 'g' cycles off/gaussian/bilateral
+//the bilateral keeps edges sharper but takes about 3 ms a frame to the gaussian's 1.5
+#define DEFAULT_SMOOTH_MODE SPATIAL_SMOOTH_GAUSSIAN
+#define DEFAULT_GAUSSIAN_RADIUS 2
+#define DEFAULT_BILATERAL_RADIUS 8
+#define DEFAULT_BILATERAL_RANGE 8
 
 #define DEPTH_CB_X 640
 #define DEPTH_CB_Y 480
-#define DEPTH_CB_RANGE 2048
 
 
 /** 
@@ -89,106 +111,377 @@ int freenect_led;
 freenect_video_format requested_format = FREENECT_VIDEO_RGB;
 freenect_video_format current_format = FREENECT_VIDEO_RGB;
 
-colour8_t spectrum[DEPTH_CB_RANGE];
-
-int num_colours;
-colour8_t colours[DEFAULT_COLOUR_CAP];
-float colour_weight[DEFAULT_COLOUR_CAP];
+//what the tables are built from, changed by the keys and the config file
+//guarded by settings_mutex, settings_changed wakes the table builder
+contour_settings_t contour_settings;
+int settings_changed = 0;
+pthread_mutex_t settings_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t settings_cond = PTHREAD_COND_INITIALIZER;
+pthread_t tables_thread;
+
+//tables: owned by depthCB, used for a whole frame
+//pending_tables: built and waiting to be picked up at the start of a frame
+//spare_tables: retired by depthCB, for the builder to fill next
+contour_tables_t * tables;
+_Atomic(contour_tables_t *) pending_tables;
+_Atomic(contour_tables_t *) spare_tables;
 
 uint8_t * ghettoContourMasks;
-
-uint16_t contour_range = 250;
-int contour_start = 500;
-int num_contour_masks = 25;
-int contour_mask_range;
+//1 where a pixel's label differs from a 4-neighbour, one row at a time
+uint8_t contour_edges[DEPTH_CB_X];
+
+spatial_holes_t depth_holes;
+uint16_t * depth_filled;
+
+//hands reaching into the sandbox are replaced by the sand under them, toggled with 'h'
+occlusion_t occluders;
+uint16_t * depth_clean;
+volatile int reject_hands = 1;
+int hands_rejected = 0;
+int stage_hands;
+spatial_smooth_t depth_smooth;
+volatile int smooth_mode = DEFAULT_SMOOTH_MODE;
+int gaussian_radius = DEFAULT_GAUSSIAN_RADIUS;
+int bilateral_radius = DEFAULT_BILATERAL_RADIUS;
+int bilateral_range = DEFAULT_BILATERAL_RANGE;
+
+//running without a window, see headless.h
+headless_options_t headless;
+headless_sink_t frame_sink;
+headless_timing_t depth_timing;
+int stage_fill;
+int stage_smooth;
+int stage_contour;
+
+//contours as GL line strips instead of blackened pixels, toggled with 'v'
+//lines_mid is handed to the GL thread with depth_mid, under gl_backbuf_mutex
+volatile int vector_contours = 1;
+workers_t contour_workers;
+isolines_t isolines;
+isoline_set_t lines_mid;
+isoline_set_t lines_front;
+
+//every frame's lines streamed out as GeoJSON or SVG, see vectorsink.h
+vector_options_t vector_options;
+vector_sink_t vector_sink;
+uint32_t vector_frame;
+int stage_export;
+
+//only the tile rows whose depth moved are contoured and uploaded again, see tiles.h
+//each frame buffer's stamps travel with it, under gl_backbuf_mutex
+tiles_t contour_tiles;
+uint32_t * stamps_mid;
+uint32_t * stamps_front;
+uint32_t * texture_stamps;
+int drawn_vectors = -1;
 
 int main(int argc, char ** argv){
+	headless_parse_args(&headless, &argc, argv);
+	vector_parse_args(&vector_options, &argc, argv);
+	if(headless.enabled && headless_sink_open(&frame_sink, headless.sink_spec, DEPTH_CB_X, DEPTH_CB_Y) < 0) {
+		return 1;
+	}
+	if(vector_sink_open(&vector_sink, vector_options.spec, DEPTH_CB_X, DEPTH_CB_Y, vector_options.tolerance) < 0) {
+		return 1;
+	}
+	headless_timing_init(&depth_timing, "depthCB", headless.enabled);
+	stage_hands = headless_stage(&depth_timing, "hands");
+	stage_fill = headless_stage(&depth_timing, "fill");
+	stage_smooth = headless_stage(&depth_timing, "smooth");
+	stage_contour = headless_stage(&depth_timing, "contour");
+	stage_export = headless_stage(&depth_timing, "export");
+
 	//allocate blocks of heap memory for frames
 	depth_front = (colour8_t *)verifyMemory(malloc(DEPTH_CB_X * DEPTH_CB_Y * 3));
 	depth_mid = (colour8_t *)verifyMemory(malloc(DEPTH_CB_X * DEPTH_CB_Y * 3));
 	frame_clone = (colour8_t *)verifyMemory(malloc(DEPTH_CB_X * DEPTH_CB_Y * 3));
-	//spectrum = (colour8_t *)verifyMemory(malloc(DEPTH_CB_RANGE * 3));
-	initSpectrum();
+	initContourTables();
 
 	ghettoContourMasks = (uint8_t *)verifyMemory(malloc(DEPTH_CB_X * DEPTH_CB_Y*sizeof(uint8_t)));
-	contour_mask_range = contour_range / num_contour_masks;
-	
-	initKinect(argc, argv);
+	if(tiles_init(&contour_tiles, DEPTH_CB_X, DEPTH_CB_Y, TILES_SIZE, TILES_THRESHOLD) < 0) {
+		fprintf(stderr, "Failed to allocate change tracking, exiting\n");
+		exit(1);
+	}
+	stamps_mid = (uint32_t *)verifyMemory(tiles_alloc_stamps(&contour_tiles));
+	stamps_front = (uint32_t *)verifyMemory(tiles_alloc_stamps(&contour_tiles));
+	texture_stamps = (uint32_t *)verifyMemory(tiles_alloc_stamps(&contour_tiles));
 
-	if (pthread_create(&freenect_thread, NULL, freenectThreadfunc, NULL) != 0) {
+	if(workers_init(&contour_workers, workers_default_count()) < 0
+			|| isolines_init(&isolines, DEPTH_CB_X, DEPTH_CB_Y, &contour_workers) < 0) {
+		fprintf(stderr, "Failed to start contour extraction, exiting\n");
+		exit(1);
+	}
+	isolines_set_levels(&isolines, tables->settings.start, tables->band_size, tables->settings.bands + 1);
+	isoline_set_init(&lines_mid);
+	isoline_set_init(&lines_front);
+	//sinks only ever see the pixels
+	if(headless.enabled) {
+		vector_contours = 0;
+	}
+
+	//raw depth with the 2047 (no reading) pixels painted in from their surroundings
+	depth_filled = (uint16_t *)verifyMemory(malloc(DEPTH_CB_X * DEPTH_CB_Y * sizeof(uint16_t)));
+	depth_clean = (uint16_t *)verifyMemory(malloc(DEPTH_CB_X * DEPTH_CB_Y * sizeof(uint16_t)));
+	if(occlusion_init(&occluders, DEPTH_CB_X * DEPTH_CB_Y) < 0) {
+		fprintf(stderr, "Failed to allocate the sand model, exiting\n");
+		exit(1);
+	}
+	if(spatial_holes_init(&depth_holes, DEPTH_CB_X, DEPTH_CB_Y, DEPTH_CB_RANGE-1) < 0) {
+		fprintf(stderr, "Failed to allocate hole filling pyramid, exiting\n");
+		exit(1);
+	}
+	if(spatial_smooth_init(&depth_smooth, DEPTH_CB_X, DEPTH_CB_Y, DEPTH_CB_RANGE-1) < 0) {
+		fprintf(stderr, "Failed to allocate smoothing buffers, exiting\n");
+		exit(1);
+	}
+
+	if(pthread_create(&tables_thread, NULL, tablesThreadfunc, NULL) != 0) {
 		fprintf(stderr, "pthread_create failed\n");
-		freenect_shutdown(f_ctx);
 		return 1;
 	}
+
+	if(headless.synthetic) {
+		if (pthread_create(&freenect_thread, NULL, syntheticThreadfunc, NULL) != 0) {
+			fprintf(stderr, "pthread_create failed\n");
+			return 1;
+		}
+	} else {
+		initKinect(argc, argv);
+
+		if (pthread_create(&freenect_thread, NULL, freenectThreadfunc, NULL) != 0) {
+			fprintf(stderr, "pthread_create failed\n");
+			freenect_shutdown(f_ctx);
+			return 1;
+		}
+	}
+
+	if(headless.enabled) {
+		runHeadless();
+		return 0;
+	}
 	
 	launchGL(argc, argv);
 
 	return 0;
 }
 
-//TODO: remove this function, add i/o to separate file and push this code to main
-// generate spectrum can persist as it is reusable
-void initSpectrum() {
-	/*FILE * colour_init;
-
-	//init colours from file
-	colour_init = fopen(DEFAULT_INIT_PATH, "r");
-	num_colours = 0;
-	while(num_colours < DEFAULT_COLOUR_CAP) {
-		int inp1;
-		int inp2;
-		int inp3;
-
-		//TODO: put i/o in separate file
-		if(fscanf(colour_init, "%f %d %d %d", &(colour_weight[num_colours]), &inp1, &inp2, &inp3) > 0) {
-			printf("Got colour %f - %d|%d|%d\n", colour_weight[num_colours], inp1, inp2, inp3);
-			colours[num_colours].red = (uint8_t)inp1;
-			colours[num_colours].green = (uint8_t)inp2;
-			colours[num_colours].blue = (uint8_t)inp3;
-			num_colours++;
+//the original palette, used unless colour.init or the config file bring their own
+void defaultSettings(contour_settings_t * settings) {
+	static const uint8_t ramp[8][3] = {
+		{0, 0, 0}, {255, 0, 0}, {0, 255, 0}, {0, 0, 255},
+		{255, 255, 0}, {0, 255, 255}, {255, 0, 255}, {255, 255, 255}
+	};
+
+	memset(settings, 0, sizeof(*settings));
+	settings->start = DEFAULT_CONTOUR_START;
+	settings->range = DEFAULT_CONTOUR_RANGE;
+	settings->bands = DEFAULT_CONTOUR_BANDS;
+	settings->palette.count = 8;
+	memcpy(settings->palette.rgb, ramp, sizeof(ramp));
+	settings->palette.weight[0] = 1;
+	settings->palette.weight[1] = 1;
+	settings->palette.weight[2] = 1;
+}
+
+//reads the settings the config file mentions over the ones in settings
+//lines are "start <raw>", "range <raw>", "bands <n>" and "colour <weight> <r> <g> <b>";
+//any colour line replaces the whole palette, which needs at least two colours
+//returns -1 if the file can't be read
+int loadContourConfig(const char * path, contour_settings_t * settings) {
+	FILE * f = fopen(path, "r");
+	char line[DEFAULT_LINE_BUFFER_BYTES];
+	contour_settings_t loaded = *settings;
+	colour_palette_t palette;
+	float total_weight = 0;
+	int colours = 0;
+	int c;
+
+	if(f == NULL) {
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f) != NULL) {
+		int v, r, g, b;
+		float w;
+		if(sscanf(line, "start %d", &v) == 1) {
+			loaded.start = v;
+		} else if(sscanf(line, "range %d", &v) == 1) {
+			loaded.range = v;
+		} else if(sscanf(line, "bands %d", &v) == 1) {
+			loaded.bands = v;
+		} else if(sscanf(line, "colour %f %d %d %d", &w, &r, &g, &b) == 4 && colours < COLOURMAP_PALETTE_CAP) {
+			palette.weight[colours] = w < 0 ? 0 : w;
+			palette.rgb[colours][0] = (uint8_t)(r < 0 ? 0 : (r > 255 ? 255 : r));
+			palette.rgb[colours][1] = (uint8_t)(g < 0 ? 0 : (g > 255 ? 255 : g));
+			palette.rgb[colours][2] = (uint8_t)(b < 0 ? 0 : (b > 255 ? 255 : b));
+			colours++;
+		}
+	}
+	fclose(f);
+
+	for(c=0;c<colours-1;c++) {
+		total_weight += palette.weight[c];
+	}
+	if(colours == 1 || (colours > 1 && total_weight <= 0)) {
+		fprintf(stderr, "%s: a palette needs two colours and some weight between them, keeping the old one\n", path);
+	} else if(colours > 1) {
+		palette.count = colours;
+		loaded.palette = palette;
+	}
+	if(loaded.start < 0 || loaded.range < 1 || loaded.start + loaded.range > DEPTH_CB_RANGE
+			|| loaded.bands < 1 || loaded.bands > MAX_CONTOUR_BANDS) {
+		fprintf(stderr, "%s: contour range out of bounds, keeping the old one\n", path);
+		loaded.start = settings->start;
+		loaded.range = settings->range;
+		loaded.bands = settings->bands;
+	}
+	*settings = loaded;
+	return 0;
+}
+
+//spectrum and band labels for one set of settings
+void buildContourTables(contour_tables_t * t, const contour_settings_t * settings) {
+	uint32_t packed[DEPTH_CB_RANGE];
+	int d;
+
+	t->settings = *settings;
+	t->band_size = settings->range / settings->bands;
+	if(t->band_size < 1) {
+		t->band_size = 1;
+	}
+	colourmap_ramp(packed, DEPTH_CB_RANGE, &settings->palette);
+	for(d=0;d<DEPTH_CB_RANGE;d++) {
+		t->spectrum[d].red = (uint8_t)packed[d];
+		t->spectrum[d].green = (uint8_t)(packed[d] >> 8);
+		t->spectrum[d].blue = (uint8_t)(packed[d] >> 16);
+	}
+	for(d=0;d<DEPTH_CB_RANGE;d++) {
+		if(d < settings->start || d > settings->range + settings->start) {
+			t->labels[d] = 255;
 		} else {
-			break;
+			//a range that doesn't split evenly leaves a remainder past the last band, it joins that band
+			int band = (d - settings->start) / t->band_size;
+			t->labels[d] = (uint8_t)(band < settings->bands ? band : settings->bands - 1);
 		}
 	}
-	fclose(colour_init);*/
-	colour_weight[0] = 1;
-	colour_weight[1] = 1;
-	colour_weight[2] = 1;
+}
 
-	num_colours = 8;
-	colours[0].red=0;
-	colours[0].green=0;
-	colours[0].blue=0;
-	
-	colours[1].red=255;
-	colours[1].green=0;
-	colours[1].blue=0;
+//the first tables are built right here, so depthCB always has some
+void initContourTables() {
+	defaultSettings(&contour_settings);
+	//the generated scene lies beyond the defaults, which suit a Kinect over a sandbox
+	if(headless.synthetic) {
+		contour_settings.start = HEADLESS_SYNTHETIC_NEAR;
+		contour_settings.range = HEADLESS_SYNTHETIC_FAR - HEADLESS_SYNTHETIC_NEAR;
+	}
+	if(colourmap_load_palette(&contour_settings.palette, DEFAULT_INIT_PATH) > 0) {
+		printf("Loaded %d colours from %s\n", contour_settings.palette.count, DEFAULT_INIT_PATH);
+	}
+	if(loadContourConfig(DEFAULT_CONFIG_PATH, &contour_settings) == 0) {
+		printf("Loaded contour settings from %s\n", DEFAULT_CONFIG_PATH);
+	}
+	tables = (contour_tables_t *)verifyMemory(malloc(sizeof(contour_tables_t)));
+	buildContourTables(tables, &contour_settings);
+	atomic_init(&pending_tables, NULL);
+	atomic_init(&spare_tables, NULL);
+}
 
-	colours[2].red=0;
-	colours[2].green=255;
-	colours[2].blue=0;
+//builds tables whenever the settings change and leaves them for depthCB to swap in
+//so a retune never holds up a frame
+void * tablesThreadfunc(void * arg) {
+	contour_settings_t settings;
+	contour_tables_t * t;
 
-	colours[3].red=0;
-	colours[3].green=0;
-	colours[3].blue=255;
+	while(1) {
+		pthread_mutex_lock(&settings_mutex);
+		while(!settings_changed && !die) {
+			pthread_cond_wait(&settings_cond, &settings_mutex);
+		}
+		if(die) {
+			pthread_mutex_unlock(&settings_mutex);
+			break;
+		}
+		settings = contour_settings;
+		settings_changed = 0;
+		pthread_mutex_unlock(&settings_mutex);
+
+		t = atomic_exchange(&spare_tables, NULL);
+		if(t == NULL) {
+			t = (contour_tables_t *)malloc(sizeof(contour_tables_t));
+			if(t == NULL) {
+				fprintf(stderr, "Failed to allocate contour tables\n");
+				continue;
+			}
+		}
+		buildContourTables(t, &settings);
+		//tables depthCB never got to are superseded, keep them as the spare
+		t = atomic_exchange(&pending_tables, t);
+		if(t != NULL) {
+			free(atomic_exchange(&spare_tables, t));
+		}
+	}
+	return NULL;
+}
 
-	colours[4].red=255;
-	colours[4].green=255;
-	colours[4].blue=0;
+//picks up freshly built tables, only ever between frames
+void swapContourTables() {
+	contour_tables_t * next = atomic_exchange(&pending_tables, NULL);
 
-	colours[5].red=0;
-	colours[5].green=255;
-	colours[5].blue=255;
+	if(next == NULL) {
+		return;
+	}
+	free(atomic_exchange(&spare_tables, tables));
+	tables = next;
+	//one line on every band boundary, the ends of the range included
+	isolines_set_levels(&isolines, tables->settings.start, tables->band_size, tables->settings.bands + 1);
+	//every depth may map to a new colour or band
+	tiles_invalidate(&contour_tiles);
+}
 
-	colours[6].red=255;
-	colours[6].green=0;
-	colours[6].blue=255;
+//applies a change to the settings and wakes the table builder
+//start_step and top_step move the ends of the contour range, band_step adds or removes bands
+void adjustContours(int start_step, int top_step, int band_step) {
+	contour_settings_t * c = &contour_settings;
+	int bottom, top, bands;
+
+	pthread_mutex_lock(&settings_mutex);
+	bottom = c->start;
+	top = c->start + c->range;
+	if(start_step) {
+		resizeRange(&bottom, &top, 1, start_step);
+	}
+	if(top_step) {
+		resizeRange(&bottom, &top, 0, top_step);
+	}
+	bands = c->bands + band_step;
+	if(top - bottom >= 1 && bands >= 1 && bands <= MAX_CONTOUR_BANDS) {
+		c->start = bottom;
+		c->range = top - bottom;
+		c->bands = bands;
+		settings_changed = 1;
+		pthread_cond_signal(&settings_cond);
+	}
+	printf("Contours from %d to %d in %d bands\n", c->start, c->start + c->range, c->bands);
+	pthread_mutex_unlock(&settings_mutex);
+}
 
-	colours[7].red=255;
-	colours[7].green=255;
-	colours[7].blue=255;
+//rereads the config file on top of the current settings
+void reloadContourConfig() {
+	pthread_mutex_lock(&settings_mutex);
+	if(loadContourConfig(DEFAULT_CONFIG_PATH, &contour_settings) < 0) {
+		fprintf(stderr, "Could not read %s\n", DEFAULT_CONFIG_PATH);
+	} else {
+		settings_changed = 1;
+		pthread_cond_signal(&settings_cond);
+	}
+	pthread_mutex_unlock(&settings_mutex);
+}
 
-	generateSpectrum(&spectrum, DEPTH_CB_RANGE, &colours, &colour_weight, num_colours);
+//wakes the table builder so it sees die, and waits for it
+void stopTablesThread() {
+	pthread_mutex_lock(&settings_mutex);
+	pthread_cond_broadcast(&settings_cond);
+	pthread_mutex_unlock(&settings_mutex);
+	pthread_join(tables_thread, NULL);
 }
 
 void initKinect(int cargc, char ** cargv) {
@@ -253,6 +546,9 @@ void launchGL(int g_argc, char ** g_argv) {
 	glBindTexture(GL_TEXTURE_2D, gl_depth_tex);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	//storage is allocated once, frames only replace the rows that changed
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, DEPTH_CB_X, DEPTH_CB_Y, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
 
 	resizeGLScene(DEFAULT_WINDOW_X, DEFAULT_WINDOW_Y);
 	glutMainLoop();
@@ -286,61 +582,278 @@ void *freenectThreadfunc(void *arg) {
 	#ifdef RT_DEBUG
 	printf("<freenectThreadfunc()> done!\n");
 	#endif
+	stopStream();
 	return NULL;
 }
 
+//stands in for the Kinect: generated frames straight into depthCB, paced at 30Hz only when drawing
+void *syntheticThreadfunc(void *arg) {
+	uint16_t * frame = (uint16_t *)verifyMemory(malloc(DEPTH_CB_X * DEPTH_CB_Y * sizeof(uint16_t)));
+	unsigned n = 0;
+
+	while(!die) {
+		headless_synthetic_depth(frame, DEPTH_CB_X, DEPTH_CB_Y, n);
+		depthCB(NULL, frame, n*33);
+		n++;
+		if(!headless.enabled) {
+			usleep(33333);
+		}
+	}
+	free(frame);
+	stopStream();
+	return NULL;
+}
+
+//marks the depth stream as finished and wakes anyone waiting for a frame
+void stopStream() {
+	pthread_mutex_lock(&gl_backbuf_mutex);
+	die = 1;
+	pthread_cond_broadcast(&gl_frame_cond);
+	pthread_mutex_unlock(&gl_backbuf_mutex);
+	pthread_mutex_lock(&settings_mutex);
+	pthread_cond_broadcast(&settings_cond);
+	pthread_mutex_unlock(&settings_mutex);
+}
+
+//takes the place of the GLUT loop: every new frame goes to the sink instead of the screen
+void runHeadless() {
+	headless_timing_t sink_timing;
+	int stage_write;
+	uint32_t seq = 0;
+	colour8_t * tmp;
+	double t0;
+
+	headless_timing_init(&sink_timing, "sink", 1);
+	stage_write = headless_stage(&sink_timing, "write");
+	while(!die) {
+		pthread_mutex_lock(&gl_backbuf_mutex);
+		while(!got_depth && !die) {
+			pthread_cond_wait(&gl_frame_cond, &gl_backbuf_mutex);
+		}
+		if(die) {
+			pthread_mutex_unlock(&gl_backbuf_mutex);
+			break;
+		}
+		tmp = depth_front;
+		depth_front = depth_mid;
+		depth_mid = tmp;
+		swapStamps();
+		got_depth = 0;
+		pthread_mutex_unlock(&gl_backbuf_mutex);
+
+		t0 = headless_now_ms();
+		if(headless_sink_write(&frame_sink, (uint8_t *)depth_front, ++seq) < 0) {
+			die = 1;
+		}
+		headless_time(&sink_timing, stage_write, headless_now_ms() - t0);
+		headless_frame_done(&sink_timing);
+		if(headless.max_frames && frame_sink.written >= headless.max_frames) {
+			die = 1;
+		}
+	}
+	pthread_join(freenect_thread, NULL);
+	headless_sink_close(&frame_sink);
+	freeContours();
+	free(depth_mid);
+	free(depth_front);
+	free(frame_clone);
+}
+
+//releases the smoothing, contour extraction and lines, once the depth thread has stopped
+void freeContours() {
+	stopTablesThread();
+	isolines_free(&isolines);
+	spatial_smooth_free(&depth_smooth);
+	free(tables);
+	free(atomic_exchange(&pending_tables, NULL));
+	free(atomic_exchange(&spare_tables, NULL));
+	workers_free(&contour_workers);
+	isoline_set_free(&lines_mid);
+	isoline_set_free(&lines_front);
+	vector_sink_close(&vector_sink);
+	occlusion_free(&occluders);
+	free(depth_clean);
+	tiles_free(&contour_tiles);
+	free(stamps_mid);
+	free(stamps_front);
+	free(texture_stamps);
+}
+
 //draws the frame dictated by the kinect's depth callback into depth_mid
 void depthCB(freenect_device *dev, void *v_depth, uint32_t timestamp) {
 	int i;
-	int p;
-	uint16_t *depth = (uint16_t*)v_depth;
+	int ty, y0, y1;
+	uint16_t *depth = depth_filled;
+	int vectors;
+	int lines = -1;
+	double t0, t1;
+
+	t0 = headless_now_ms();
+	if(reject_hands) {
+		//switched back on, the model starts over from this frame, which should be bare sand
+		if(!hands_rejected) {
+			occlusion_reset(&occluders);
+		}
+		occlusion_apply(&occluders, (uint16_t*)v_depth, depth_clean);
+		v_depth = depth_clean;
+		t1 = headless_now_ms();
+		headless_time(&depth_timing, stage_hands, t1 - t0);
+		t0 = t1;
+	}
+	hands_rejected = reject_hands;
+	spatial_fill_holes(&depth_holes, (uint16_t*)v_depth, depth_filled);
+	t1 = headless_now_ms();
+	headless_time(&depth_timing, stage_fill, t1 - t0);
+
+	//smoothed in place, contours of the raw disparity flicker from frame to frame
+	if(smooth_mode == SPATIAL_SMOOTH_GAUSSIAN) {
+		spatial_gaussian(&depth_smooth, gaussian_radius, depth_filled, depth_filled);
+	} else if(smooth_mode == SPATIAL_SMOOTH_BILATERAL) {
+		spatial_bilateral(&depth_smooth, bilateral_radius, bilateral_range, depth_filled, depth_filled);
+	}
+	t0 = headless_now_ms();
+	headless_time(&depth_timing, stage_smooth, t0 - t1);
+	t1 = t0;
+
+	swapContourTables();
+	vectors = vector_contours;
+	if(vectors || vector_sink.format != VECTOR_SINK_NONE) {
+		lines = isolines_extract(&isolines, depth_filled, DEPTH_CB_RANGE-1);
+	}
+	//written before taking the lock, a slow reader only ever holds up this thread
+	if(lines >= 0 && vector_sink.format != VECTOR_SINK_NONE) {
+		t0 = headless_now_ms();
+		vector_sink_write(&vector_sink, &isolines.lines, tables->settings.start, tables->band_size, vector_frame++);
+		headless_time(&depth_timing, stage_export, headless_now_ms() - t0);
+	}
+
+	//pixel contours look at the rows either side, so they redo the whole frame when switched
+	if(vectors != drawn_vectors) {
+		tiles_invalidate(&contour_tiles);
+	}
+	drawn_vectors = vectors;
+	tiles_update(&contour_tiles, depth);
 
 	pthread_mutex_lock(&gl_backbuf_mutex);
-	
-	for(i=0;i<DEPTH_CB_X * DEPTH_CB_Y;i++) {
-		//prime each pixel
-		depth_mid[i] = spectrum[depth[i]];
-		//prime the contourmasks
-		if(depth[i] < contour_start || depth[i] > contour_range + contour_start) {
-			ghettoContourMasks[i] = 255;
+
+	//depth_mid last held a frame or two ago, it needs the tile rows that changed since
+	for(ty=0;ty<contour_tiles.rows;ty++) {
+		if(!tiles_row_stale(&contour_tiles, stamps_mid, contour_tiles.changed, ty)) {
+			continue;
+		}
+		y0 = ty * contour_tiles.size;
+		y1 = y0 + contour_tiles.size < DEPTH_CB_Y ? y0 + contour_tiles.size : DEPTH_CB_Y;
+		if(vectors) {
+			for(i=y0*DEPTH_CB_X;i<y1*DEPTH_CB_X;i++) {
+				depth_mid[i] = tables->spectrum[depth[i]];
+			}
 		} else {
-			ghettoContourMasks[i] = (uint8_t)((depth[i]-contour_start)/ contour_mask_range);
+			//edges on the first and last row depend on the tile rows around, which may not have changed
+			contourRows(tables, depth, y0 > 0 ? y0 - 1 : 0, y1 < DEPTH_CB_Y ? y1 + 1 : DEPTH_CB_Y);
 		}
 	}
-	
-	for(i=1; i<DEPTH_CB_Y-1; i++) {
-		for(int j=1; j<DEPTH_CB_X-1; j++){
-			p=(i*DEPTH_CB_X) + j;
-			assert(p-1 > 0);
-			if(!(ghettoContourMasks[p]==ghettoContourMasks[p-1])){
-				depth_mid[p].red = 0;
-				depth_mid[p].green = 0;
-				depth_mid[p].blue = 0;
-			}
-			assert(p+1 < DEPTH_CB_X * DEPTH_CB_Y);
-			if(!(ghettoContourMasks[p]==ghettoContourMasks[p+1])){
-				depth_mid[p].red = 0;
-				depth_mid[p].green = 0;
-				depth_mid[p].blue = 0;
-			}
-			assert(p+DEPTH_CB_X < DEPTH_CB_X * DEPTH_CB_Y);
-			if(!(ghettoContourMasks[p]==ghettoContourMasks[p+DEPTH_CB_X])){
-				depth_mid[p].red = 0;
-				depth_mid[p].green = 0;
-				depth_mid[p].blue = 0;
-			}
-			assert(p-DEPTH_CB_X > 0);
-			if(!(ghettoContourMasks[p]==ghettoContourMasks[p-DEPTH_CB_X])){
-				depth_mid[p].red = 0;
-				depth_mid[p].green = 0;
-				depth_mid[p].blue = 0;
-			}
+	tiles_stamp(&contour_tiles, stamps_mid);
+	if(vectors) {
+		if(lines < 0 || isoline_set_copy(&lines_mid, &isolines.lines) < 0) {
+			lines_mid.point_count = 0;
+			lines_mid.strip_count = 0;
 		}
 	}
 
 	got_depth++;
 	pthread_cond_signal(&gl_frame_cond);
 	pthread_mutex_unlock(&gl_backbuf_mutex);
+	headless_time(&depth_timing, stage_contour, headless_now_ms() - t1);
+	headless_frame_done(&depth_timing);
+}
+
+//labels, edges and colours rows y0 to y1 of depth_mid in one pass down the frame,
+//labelling a row ahead; the outermost rows and columns never get an edge
+void contourRows(const contour_tables_t * t, const uint16_t * depth, int y0, int y1) {
+	int y, p;
+
+	if(y0 > 0) {
+		labelRow(t->labels, depth + (y0 - 1) * DEPTH_CB_X, ghettoContourMasks + (y0 - 1) * DEPTH_CB_X, DEPTH_CB_X);
+	}
+	labelRow(t->labels, depth + y0 * DEPTH_CB_X, ghettoContourMasks + y0 * DEPTH_CB_X, DEPTH_CB_X);
+	for(y=y0; y<y1; y++) {
+		p = y * DEPTH_CB_X;
+		if(y + 1 < DEPTH_CB_Y) {
+			labelRow(t->labels, depth + p + DEPTH_CB_X, ghettoContourMasks + p + DEPTH_CB_X, DEPTH_CB_X);
+		}
+		if(y > 0 && y + 1 < DEPTH_CB_Y) {
+			edgeRow(ghettoContourMasks + p - DEPTH_CB_X, ghettoContourMasks + p,
+				ghettoContourMasks + p + DEPTH_CB_X, contour_edges, DEPTH_CB_X);
+		} else {
+			memset(contour_edges, 0, DEPTH_CB_X);
+		}
+		colourRow(t->spectrum, depth + p, contour_edges, depth_mid + p, DEPTH_CB_X);
+	}
+}
+
+//swaps the stamps along with depth_mid and depth_front, under gl_backbuf_mutex
+void swapStamps() {
+	uint32_t * tmp = stamps_front;
+	stamps_front = stamps_mid;
+	stamps_mid = tmp;
+}
+
+//sends the texture the tile rows of frame that differ from what it holds, one rectangle per run of rows
+//the rows either side of each run go too, the pixel contours may have redrawn them
+void uploadStaleRows(const uint8_t * frame, const uint32_t * stamps) {
+	int ty = 0;
+
+	while(ty < contour_tiles.rows) {
+		int first = ty;
+		int y0, y1;
+		if(!tiles_row_stale(&contour_tiles, texture_stamps, stamps, ty)) {
+			ty++;
+			continue;
+		}
+		while(ty < contour_tiles.rows && tiles_row_stale(&contour_tiles, texture_stamps, stamps, ty)) {
+			ty++;
+		}
+		y0 = first * contour_tiles.size;
+		y1 = ty * contour_tiles.size < DEPTH_CB_Y ? ty * contour_tiles.size : DEPTH_CB_Y;
+		y0 = y0 > 0 ? y0 - 1 : 0;
+		y1 = y1 < DEPTH_CB_Y ? y1 + 1 : DEPTH_CB_Y;
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y0, DEPTH_CB_X, y1 - y0, GL_RGB, GL_UNSIGNED_BYTE, frame + y0 * DEPTH_CB_X * 3);
+	}
+	memcpy(texture_stamps, stamps, contour_tiles.count * sizeof(uint32_t));
+}
+
+//contour band label of every pixel in a row
+void labelRow(const uint8_t * restrict lut, const uint16_t * restrict depth, uint8_t * restrict labels, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		labels[i] = lut[depth[i]];
+	}
+}
+
+//marks the pixels of the middle row whose label differs from any 4-neighbour
+//branch free over whole rows so it vectorizes, the first and last pixel are never edges
+void edgeRow(const uint8_t * restrict up, const uint8_t * restrict mid, const uint8_t * restrict down,
+		uint8_t * restrict edges, int count) {
+	int i;
+	for(i=1;i<count-1;i++) {
+		uint8_t m = mid[i];
+		edges[i] = (m != mid[i-1]) | (m != mid[i+1]) | (m != up[i]) | (m != down[i]);
+	}
+	edges[0] = 0;
+	edges[count-1] = 0;
+}
+
+//spectrum colour of every pixel in a row, black on the edges
+void colourRow(const colour8_t * restrict lut, const uint16_t * restrict depth, const uint8_t * restrict edges,
+		colour8_t * restrict out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		colour8_t c = lut[depth[i]];
+		uint8_t keep = (uint8_t)(edges[i] - 1);
+		out[i].red = c.red & keep;
+		out[i].green = c.green & keep;
+		out[i].blue = c.blue & keep;
+	}
 }
 
 //Attemps to pull data from the kinect's depth camera and draw the next frame using it.
@@ -362,18 +875,23 @@ void drawGLScene() {
 	}
 
 	colour8_t *tmp;
+	isoline_set_t lines_tmp;
 
 	if (got_depth) {
 		tmp = depth_front;
 		depth_front = depth_mid;
 		depth_mid = tmp;
+		lines_tmp = lines_front;
+		lines_front = lines_mid;
+		lines_mid = lines_tmp;
+		swapStamps();
 		got_depth = 0;
 	}
 
 
 	pthread_mutex_unlock(&gl_backbuf_mutex);
 	glBindTexture(GL_TEXTURE_2D, gl_depth_tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, 640, 480, 0, GL_RGB, GL_UNSIGNED_BYTE, (uint8_t *)depth_front);
+	uploadStaleRows((uint8_t *)depth_front, stamps_front);
 
 	int camera_angle = 0;
 	glLoadIdentity();
@@ -405,9 +923,33 @@ void drawGLScene() {
 	glEnd();
 	glPopMatrix();
 
+	if(vector_contours) {
+		drawContours();
+	}
+
 	glutSwapBuffers();
 }
 
+//draws lines_front over the depth image, the lines are in image pixels with y down
+void drawContours() {
+	int i;
+
+	glDisable(GL_TEXTURE_2D);
+	glColor4f(0.0f, 0.0f, 0.0f, 1.0f);
+	glLineWidth(2.0f);
+	glPushMatrix();
+	glTranslatef(0.5f, DEPTH_CB_Y - 0.5f, 0.0f);
+	glScalef(1.0f, -1.0f, 1.0f);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 0, lines_front.points);
+	for(i=0;i<lines_front.strip_count;i++) {
+		glDrawArrays(GL_LINE_STRIP, lines_front.strips[i].start, lines_front.strips[i].count);
+	}
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glPopMatrix();
+	glEnable(GL_TEXTURE_2D);
+}
+
 //resizes the glfuncs to match the new viewport size
 void resizeGLScene(int Width, int Height) {
 	glViewport(0,0,Width,Height);
@@ -441,76 +983,7 @@ int resizeRange(int * rbottom, int * rtop, int rdir, int dist) {
 		*rbottom = 0;
 	}
 
-	return (*rbottom - *rtop);
-}
-
-//generate a spectrum representing linear gradients between each breakpoint colour
-void generateSpectrum(colour8_t * dump, int size, colour8_t * breakpoints, float * colour_weights, int num_breakpoints) {
-	#ifdef INIT_DEBUG
-	printf("generateSpectrum(*dump, %d, *breakpoints, floatlist, %d)\n", size, num_breakpoints);
-	printf("colour_weights[x], 0=%f, 1=%f, 2=%f, 3=%f\n", colour_weights[0], colour_weights[1], colour_weights[2], colour_weights[3]);
-	#endif
-	//used to determine what %slice of the spectrum each gradient receives
-	float total_weight = 0;
-	//used to avoid missing integers due to imprecision, the weight algorithm is imperfect
-	int colourpos = 0;
-	//temp vars for readability
-	int r,g,b;
-	float cfr,cto;
-
-	colour8_t colour_from;
-	colour8_t colour_to;
-
-	if (num_breakpoints <= 1){
-		//two few colours, at least two colours (and hence one gradient weight) are required, generate default spectrum in this case.
-		fprintf(stderr, "too few breakpoints specified, generating default spectrum\n");
-		fprintf(stderr, "code incomplete, exiting\n");
-		//generate 255-0-0 _1.0_ 0-255-0 _1.0_ 0-0-255
-		exit(77);
-	}
-	for(int i=0;i<num_breakpoints-1;i++) {
-		total_weight+=colour_weights[i];
-	}
-	
-	for(int c=0;c<num_breakpoints-1;c++) {
-		int colour_dist = (colour_weights[c] / total_weight) * size; //the number of discrete blocks which will be subject to the gradient from colour[c] -> colour[c+1]
-		colour_to = breakpoints[c+1];
-		colour_from = breakpoints[c];
-
-		//legacy error handling and algorithm imprecision, usually several memory slots remain untouched, likely due to truncating floats
-		if(colourpos + colour_dist > size || c == num_breakpoints-2) {
-			colour_dist = size - colourpos;
-		}
-
-		for(int i=0; i < colour_dist;i++) {
-			
-			#ifdef INIT_DEBUG 
-			assert(colourpos<size);
-			#endif
-
-			cto = ((float)i) / ((float)colour_dist);
-			cfr = 1-( ((float)i) / ((float)colour_dist) );
-
-			r = (int) ((cto * ((float)colour_to.red)) + (cfr * ((float)colour_from.red)));
-			g = (int) ((cto * ((float)colour_to.green)) + (cfr * ((float)colour_from.green)));
-			b = (int) ((cto * ((float)colour_to.blue)) + (cfr * ((float)colour_from.blue)));
-
-			(dump[colourpos]).red = (uint8_t)r;
-			(dump[colourpos]).green = (uint8_t)g;
-			(dump[colourpos]).blue = (uint8_t)b;
-			colourpos++;
-		}
-	}
-
-	#ifdef INIT_DEBUG
-	for(int i=0;i<size;i++){
-		r = (int)((dump[i]).red); 
-		g = (int)((dump[i]).green);
-		b = (int)((dump[i]).blue);
-
-		printf("colour[%d] = (%d %d %d)\n", i, (int)r, (int)g, b);
-	}
-	#endif
+	return (*rtop - *rbottom);
 }
 
 void keyPressed(unsigned char key, int x, int y) {
@@ -518,11 +991,35 @@ void keyPressed(unsigned char key, int x, int y) {
 		die = 1;
 		pthread_join(freenect_thread, NULL);
 		glutDestroyWindow(window);
+		freeContours();
 		free(depth_mid);
 		free(depth_front);
 		free(frame_clone);
 		exit(0);
 	}
+	if (key == 'v') {
+		vector_contours = !vector_contours;
+	}
+	if (key == 'g') {
+		smooth_mode = (smooth_mode + 1) % 3;
+	}
+	//the tables are rebuilt off the depth thread, see tablesThreadfunc
+	if (key == '[' || key == ']') {
+		adjustContours(key == ']' ? DEFAULT_RANGE_STEP : -DEFAULT_RANGE_STEP, 0, 0);
+	}
+	if (key == '{' || key == '}') {
+		adjustContours(0, key == '}' ? DEFAULT_RANGE_STEP : -DEFAULT_RANGE_STEP, 0);
+	}
+	if (key == '+' || key == '=' || key == '-') {
+		adjustContours(0, 0, key == '-' ? -1 : 1);
+	}
+	if (key == 'r') {
+		reloadContourConfig();
+	}
+	if (key == 'h') {
+		reject_hands = !reject_hands;
+		printf("Hand rejection %s\n", reject_hands ? "on" : "off");
+	}
 	return;
 }
 
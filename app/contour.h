@@ -9,16 +9,62 @@ typedef struct {
 	uint8_t blue;
 } colour8_t;
 
+#define DEPTH_CB_RANGE 2048
+
+/** contour_settings_t
+	What the contour tables are built from.
+	start, range: raw depths from start to start + range are split into bands
+	bands: how many, each range/bands raw depth deep
+	palette: stretched over every raw depth for the spectrum
+**/
+typedef struct {
+	int start;
+	int range;
+	int bands;
+	colour_palette_t palette;
+} contour_settings_t;
+
+/** contour_tables_t
+	Per raw depth lookups for one set of settings, built off the depth
+	thread and swapped into depthCB whole between frames.
+	labels: band of each depth, 255 outside the contour range
+**/
+typedef struct {
+	contour_settings_t settings;
+	int band_size;
+	colour8_t spectrum[DEPTH_CB_RANGE];
+	uint8_t labels[DEPTH_CB_RANGE];
+} contour_tables_t;
+
 void depthCB(freenect_device*, void*, uint32_t);
 void * freenectThreadfunc(void*);
+void * syntheticThreadfunc(void*);
+void stopStream();
+void runHeadless();
+void freeContours();
 void depthCallback(freenect_device *, void *, uint32_t);
 void drawGLScene();
+void drawContours();
+void contourRows(const contour_tables_t *, const uint16_t *, int, int);
+void swapStamps();
+void uploadStaleRows(const uint8_t *, const uint32_t *);
+void labelRow(const uint8_t *, const uint16_t *, uint8_t *, int);
+void edgeRow(const uint8_t *, const uint8_t *, const uint8_t *, uint8_t *, int);
+void colourRow(const colour8_t *, const uint16_t *, const uint8_t *, colour8_t *, int);
 void resizeGLScene(int, int);
 void launchGL(int, char**);
 void keyPressed(unsigned char, int, int);
 void * verifyMemory(void*);
 void initKinect(int, char**);
-void generateSpectrum(colour8_t *, int, colour8_t *, float *, int);
-void initSpectrum();
+void defaultSettings(contour_settings_t *);
+int loadContourConfig(const char *, contour_settings_t *);
+void buildContourTables(contour_tables_t *, const contour_settings_t *);
+void initContourTables();
+void * tablesThreadfunc(void *);
+void swapContourTables();
+void adjustContours(int, int, int);
+void reloadContourConfig();
+void stopTablesThread();
+int resizeRange(int *, int *, int, int);
 
 //typedef struct colour8_t;
@@ -0,0 +1,226 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "colourmap.h"
+#include "dem.h"
+
+#define DEM_DEPTH_X 640
+#define DEM_DEPTH_Y 480
+
+//allocates a width x height raster and one private tile per worker of pool
+int dem_init(dem_t * dem, int width, int height, workers_t * pool) {
+	int t;
+
+	memset(dem, 0, sizeof(*dem));
+	dem->width = width;
+	dem->height = height;
+	dem->pool = pool;
+	dem->raster = (uint16_t *)malloc(width * height * sizeof(uint16_t));
+	dem->ray_u = (float *)malloc(DEM_DEPTH_X * DEM_DEPTH_Y * sizeof(float));
+	dem->ray_v = (float *)malloc(DEM_DEPTH_X * DEM_DEPTH_Y * sizeof(float));
+	dem->tiles = (uint16_t **)calloc(pool->count, sizeof(uint16_t *));
+	if(dem->raster == NULL || dem->ray_u == NULL || dem->ray_v == NULL || dem->tiles == NULL) {
+		dem_free(dem);
+		return -1;
+	}
+	for(t=0;t<pool->count;t++) {
+		dem->tiles[t] = (uint16_t *)malloc(width * height * sizeof(uint16_t));
+		if(dem->tiles[t] == NULL) {
+			dem_free(dem);
+			return -1;
+		}
+	}
+	if(spatial_holes_init(&dem->holes, width, height, DEM_NO_HEIGHT) < 0) {
+		dem_free(dem);
+		return -1;
+	}
+	for(t=0;t<width*height;t++) {
+		dem->raster[t] = DEM_NO_HEIGHT;
+	}
+	return 0;
+}
+
+void dem_free(dem_t * dem) {
+	int t;
+	if(dem->tiles != NULL) {
+		for(t=0;t<dem->pool->count;t++) {
+			free(dem->tiles[t]);
+		}
+	}
+	free(dem->tiles);
+	free(dem->raster);
+	free(dem->ray_u);
+	free(dem->ray_v);
+	spatial_holes_free(&dem->holes);
+	dem->tiles = NULL;
+	dem->raster = NULL;
+	dem->ray_u = NULL;
+	dem->ray_v = NULL;
+}
+
+//lays the grid out on a calibrated base plane, columns following the camera's x axis
+//cell_mm <= 0 picks the cell size that just fits the camera's view of the floor
+//returns 0 on success, -1 if the plane is not calibrated or not in view
+int dem_setup(dem_t * dem, const baseplane_t * bp, float cell_mm) {
+	const float * n = bp->normal;
+	float * u = dem->axis_u;
+	float * v = dem->axis_v;
+	float lo[2] = {INFINITY, INFINITY};
+	float hi[2] = {-INFINITY, -INFINITY};
+	float len, extent;
+	int corners[4][2] = {{0, 0}, {DEM_DEPTH_X-1, 0}, {0, DEM_DEPTH_Y-1}, {DEM_DEPTH_X-1, DEM_DEPTH_Y-1}};
+	int x, y, c;
+
+	if(!bp->valid) {
+		return -1;
+	}
+	//u: camera x projected onto the plane, v = u x n keeps rows running the same way as in the image
+	u[0] = 1 - n[0]*n[0];
+	u[1] = -n[0]*n[1];
+	u[2] = -n[0]*n[2];
+	len = sqrtf(u[0]*u[0] + u[1]*u[1] + u[2]*u[2]);
+	if(len < 1e-3f) {
+		return -1;
+	}
+	u[0] /= len;
+	u[1] /= len;
+	u[2] /= len;
+	v[0] = u[1]*n[2] - u[2]*n[1];
+	v[1] = u[2]*n[0] - u[0]*n[2];
+	v[2] = u[0]*n[1] - u[1]*n[0];
+
+	for(y=0;y<DEM_DEPTH_Y;y++) {
+		for(x=0;x<DEM_DEPTH_X;x++) {
+			float rx = bp->ray_x[x];
+			float ry = bp->ray_y[y];
+			dem->ray_u[y*DEM_DEPTH_X + x] = u[0]*rx + u[1]*ry + u[2];
+			dem->ray_v[y*DEM_DEPTH_X + x] = v[0]*rx + v[1]*ry + v[2];
+		}
+	}
+
+	//where the corner rays meet the floor (height 0: z * gain + offset = 0)
+	for(c=0;c<4;c++) {
+		int i = corners[c][1]*DEM_DEPTH_X + corners[c][0];
+		float z;
+		if(bp->gain[i] > -1e-3f) {
+			continue; //this ray never reaches the floor
+		}
+		z = -bp->offset / bp->gain[i];
+		lo[0] = fminf(lo[0], z * dem->ray_u[i]);
+		hi[0] = fmaxf(hi[0], z * dem->ray_u[i]);
+		lo[1] = fminf(lo[1], z * dem->ray_v[i]);
+		hi[1] = fmaxf(hi[1], z * dem->ray_v[i]);
+	}
+	if(lo[0] >= hi[0] || lo[1] >= hi[1]) {
+		return -1;
+	}
+	if(cell_mm <= 0) {
+		cell_mm = fmaxf((hi[0] - lo[0]) / dem->width, (hi[1] - lo[1]) / dem->height);
+	}
+	dem->cell_mm = cell_mm;
+	extent = cell_mm * dem->width;
+	dem->origin[0] = (lo[0] + hi[0] - extent) / 2;
+	extent = cell_mm * dem->height;
+	dem->origin[1] = (lo[1] + hi[1] - extent) / 2;
+	dem->plane = bp;
+	return 0;
+}
+
+//phase one: worker index drops its band of depth rows into its own tile, keeping the highest sample per cell
+static void splat_band(void * arg, int index, int count) {
+	dem_t * dem = (dem_t *)arg;
+	const baseplane_t * bp = dem->plane;
+	uint16_t * tile = dem->tiles[index];
+	float inv_cell = 1.0f / dem->cell_mm;
+	float u0 = dem->origin[0];
+	float v0 = dem->origin[1];
+	int row_begin = DEM_DEPTH_Y * index / count;
+	int row_end = DEM_DEPTH_Y * (index + 1) / count;
+	int i;
+
+	//0 is below every real height slot, so it doubles as "empty"
+	memset(tile, 0, dem->width * dem->height * sizeof(uint16_t));
+	for(i=row_begin*DEM_DEPTH_X;i<row_end*DEM_DEPTH_X;i++) {
+		float z = bp->mm[dem->frame[i] & 2047];
+		float h, a, b;
+		int cx, cy;
+		long slot;
+
+		if(z <= 0) {
+			continue;
+		}
+		a = (z * dem->ray_u[i] - u0) * inv_cell;
+		b = (z * dem->ray_v[i] - v0) * inv_cell;
+		if(a < 0 || b < 0 || a >= dem->width || b >= dem->height) {
+			continue;
+		}
+		cx = (int)a;
+		cy = (int)b;
+		h = z * bp->gain[i] + bp->offset;
+		slot = lrintf(h) + COLOURMAP_HEIGHT_ZERO;
+		slot = slot < 1 ? 1 : (slot > DEM_NO_HEIGHT-1 ? DEM_NO_HEIGHT-1 : slot);
+		if(slot > tile[cy*dem->width + cx]) {
+			tile[cy*dem->width + cx] = (uint16_t)slot;
+		}
+	}
+}
+
+//phase two: worker index takes the maximum across all tiles for its band of raster rows
+static void merge_band(void * arg, int index, int count) {
+	dem_t * dem = (dem_t *)arg;
+	int begin = dem->width * (dem->height * index / count);
+	int end = dem->width * (dem->height * (index + 1) / count);
+	int tiles = dem->pool->count;
+	uint16_t * restrict raster = dem->raster;
+	int t, i;
+
+	for(i=begin;i<end;i++) {
+		raster[i] = dem->tiles[0][i];
+	}
+	for(t=1;t<tiles;t++) {
+		const uint16_t * restrict tile = dem->tiles[t];
+		for(i=begin;i<end;i++) {
+			raster[i] = tile[i] > raster[i] ? tile[i] : raster[i];
+		}
+	}
+	for(i=begin;i<end;i++) {
+		raster[i] = raster[i] ? raster[i] : DEM_NO_HEIGHT;
+	}
+}
+
+//builds dem->raster from one raw 11 bit depth frame, dem_setup must have succeeded
+void dem_generate(dem_t * dem, const uint16_t * raw) {
+	dem->frame = raw;
+	workers_run(dem->pool, splat_band, dem);
+	workers_run(dem->pool, merge_band, dem);
+	dem->frame = NULL;
+	//cells no depth pixel landed in, mostly far from the camera
+	spatial_fill_holes(&dem->holes, dem->raster, dem->raster);
+}
@@ -0,0 +1,69 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "baseplane.h"
+#include "spatial.h"
+#include "workers.h"
+
+#define DEM_NO_HEIGHT 2047
+
+/** dem_t
+	Orthographic elevation raster over the calibrated base plane.
+	Every depth pixel is dropped into a fixed grid of cells laid out on the
+	plane, each cell keeping its highest sample, and empty cells are filled
+	from their neighbours.
+	raster: width*height cells of height + COLOURMAP_HEIGHT_ZERO in mm
+	(1..2046), so it indexes the height colour table directly; DEM_NO_HEIGHT
+	only remains where the whole frame had no reading.
+	Each worker splats a band of depth rows into a private tile, then each
+	merges a band of raster rows across the tiles, so no cell is ever
+	written by two threads.
+**/
+typedef struct {
+	int width;
+	int height;
+	float cell_mm;
+	float origin[2];	//plane coordinates (mm) of the raster's top left corner
+	float axis_u[3];	//plane direction of increasing column
+	float axis_v[3];	//plane direction of increasing row
+	uint16_t * raster;
+
+	const baseplane_t * plane;
+	float * ray_u;		//per depth pixel, the viewing ray dotted with axis_u
+	float * ray_v;
+	uint16_t ** tiles;
+	workers_t * pool;
+	spatial_holes_t holes;
+	const uint16_t * frame;	//the raw frame being splatted, only valid during dem_generate
+} dem_t;
+
+int dem_init(dem_t *, int, int, workers_t *);
+void dem_free(dem_t *);
+int dem_setup(dem_t *, const baseplane_t *, float);
+void dem_generate(dem_t *, const uint16_t *);
@@ -0,0 +1,264 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "headless.h"
+
+//pulls the headless switches out of argv, leaving the rest (device number, GLUT options) in order
+void headless_parse_args(headless_options_t * opt, int * argc, char ** argv) {
+	int i;
+	int kept = 1;
+
+	memset(opt, 0, sizeof(*opt));
+	for(i=1;i<*argc;i++) {
+		if(strcmp(argv[i], "--headless") == 0) {
+			opt->enabled = 1;
+		} else if(strncmp(argv[i], "--sink=", 7) == 0) {
+			opt->sink_spec = argv[i] + 7;
+		} else if(strncmp(argv[i], "--frames=", 9) == 0) {
+			opt->max_frames = (unsigned)strtoul(argv[i] + 9, NULL, 10);
+		} else if(strcmp(argv[i], "--synthetic") == 0) {
+			opt->synthetic = 1;
+		} else if(strcmp(argv[i], "--calibrate") == 0) {
+			opt->calibrate = 1;
+		} else {
+			argv[kept++] = argv[i];
+		}
+	}
+	argv[kept] = NULL;
+	*argc = kept;
+}
+
+//opens the sink described by spec for width x height RGB frames, returns 0 on success
+int headless_sink_open(headless_sink_t * sink, const char * spec, int width, int height) {
+	memset(sink, 0, sizeof(*sink));
+	sink->width = width;
+	sink->height = height;
+	sink->shm_fd = -1;
+
+	if(spec == NULL || strcmp(spec, "none") == 0) {
+		sink->kind = HEADLESS_SINK_NONE;
+	} else if(strncmp(spec, "ppm:", 4) == 0) {
+		sink->kind = HEADLESS_SINK_PPM;
+		strncpy(sink->prefix, spec + 4, sizeof(sink->prefix) - 1);
+	} else if(strcmp(spec, "stdout") == 0) {
+		int fd;
+		sink->kind = HEADLESS_SINK_STDOUT;
+		//frames get the real stdout to themselves, everything printed from here on goes to stderr
+		fflush(stdout);
+		fd = dup(STDOUT_FILENO);
+		if(fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 || (sink->out = fdopen(fd, "wb")) == NULL) {
+			fprintf(stderr, "Could not take over stdout for frames\n");
+			return -1;
+		}
+	} else if(strncmp(spec, "shm:", 4) == 0) {
+		headless_shm_header_t * header;
+		size_t frame_offset = (sizeof(headless_shm_header_t) + 63) & ~(size_t)63;
+		size_t frame_size = ((size_t)width * height * 3 + 63) & ~(size_t)63;
+		int s;
+
+		sink->kind = HEADLESS_SINK_SHM;
+		strncpy(sink->shm_name, spec + 4, sizeof(sink->shm_name) - 1);
+		sink->shm_size = frame_offset + HEADLESS_SHM_SLOTS * frame_size;
+		sink->shm_fd = shm_open(sink->shm_name, O_CREAT | O_RDWR, 0600);
+		if(sink->shm_fd < 0 || ftruncate(sink->shm_fd, sink->shm_size) < 0) {
+			fprintf(stderr, "Could not create shared memory %s\n", sink->shm_name);
+			headless_sink_close(sink);
+			return -1;
+		}
+		sink->shm_map = (uint8_t *)mmap(NULL, sink->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, sink->shm_fd, 0);
+		if(sink->shm_map == MAP_FAILED) {
+			sink->shm_map = NULL;
+			fprintf(stderr, "Could not map shared memory %s\n", sink->shm_name);
+			headless_sink_close(sink);
+			return -1;
+		}
+		header = (headless_shm_header_t *)sink->shm_map;
+		header->width = width;
+		header->height = height;
+		header->slots = HEADLESS_SHM_SLOTS;
+		header->frame_offset = (uint32_t)frame_offset;
+		atomic_store(&header->latest, 0);
+		for(s=0;s<HEADLESS_SHM_SLOTS;s++) {
+			atomic_store(&header->slot_seq[s], 0);
+		}
+		//readers check the magic last
+		atomic_thread_fence(memory_order_release);
+		header->magic = HEADLESS_SHM_MAGIC;
+	} else {
+		fprintf(stderr, "Unknown sink %s, expected ppm:PREFIX, shm:/NAME, stdout or none\n", spec);
+		return -1;
+	}
+	return 0;
+}
+
+//hands one frame to the sink, seq must be nonzero and increasing; returns 0 on success
+int headless_sink_write(headless_sink_t * sink, const uint8_t * rgb, uint32_t seq) {
+	size_t bytes = (size_t)sink->width * sink->height * 3;
+
+	switch(sink->kind) {
+		case HEADLESS_SINK_NONE:
+			break;
+		case HEADLESS_SINK_PPM: {
+			char path[300];
+			FILE * f;
+			snprintf(path, sizeof(path), "%s%06u.ppm", sink->prefix, sink->written);
+			f = fopen(path, "wb");
+			if(f == NULL) {
+				fprintf(stderr, "Could not write %s\n", path);
+				return -1;
+			}
+			fprintf(f, "P6\n%d %d\n255\n", sink->width, sink->height);
+			fwrite(rgb, 1, bytes, f);
+			fclose(f);
+			break;
+		}
+		case HEADLESS_SINK_STDOUT:
+			//a stream of PPM images, e.g. for ffmpeg -f image2pipe -vcodec ppm
+			fprintf(sink->out, "P6\n%d %d\n255\n", sink->width, sink->height);
+			if(fwrite(rgb, 1, bytes, sink->out) != bytes || fflush(sink->out) != 0) {
+				return -1;
+			}
+			break;
+		case HEADLESS_SINK_SHM: {
+			headless_shm_header_t * header = (headless_shm_header_t *)sink->shm_map;
+			size_t frame_size = (bytes + 63) & ~(size_t)63;
+			int slot = seq % HEADLESS_SHM_SLOTS;
+			atomic_store_explicit(&header->slot_seq[slot], 0, memory_order_relaxed);
+			atomic_thread_fence(memory_order_release);
+			memcpy(sink->shm_map + header->frame_offset + slot * frame_size, rgb, bytes);
+			atomic_store_explicit(&header->slot_seq[slot], seq, memory_order_release);
+			atomic_store_explicit(&header->latest, seq, memory_order_release);
+			break;
+		}
+	}
+	sink->written++;
+	return 0;
+}
+
+void headless_sink_close(headless_sink_t * sink) {
+	if(sink->out != NULL) {
+		fclose(sink->out);
+		sink->out = NULL;
+	}
+	if(sink->shm_map != NULL) {
+		munmap(sink->shm_map, sink->shm_size);
+		sink->shm_map = NULL;
+	}
+	if(sink->shm_fd >= 0) {
+		//readers that already have the ring mapped keep it until they unmap
+		close(sink->shm_fd);
+		shm_unlink(sink->shm_name);
+		sink->shm_fd = -1;
+	}
+}
+
+double headless_now_ms() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
+
+//report: print a line to stderr every second, otherwise just collect
+void headless_timing_init(headless_timing_t * t, const char * name, int report) {
+	memset(t, 0, sizeof(*t));
+	t->name = name;
+	t->report = report;
+	t->window_start = headless_now_ms();
+}
+
+//registers a stage and returns its index for headless_time
+int headless_stage(headless_timing_t * t, const char * name) {
+	if(t->stages >= HEADLESS_MAX_STAGES) {
+		return HEADLESS_MAX_STAGES - 1;
+	}
+	t->stage_name[t->stages] = name;
+	return t->stages++;
+}
+
+void headless_time(headless_timing_t * t, int stage, double ms) {
+	t->total_ms[stage] += ms;
+	if(ms > t->max_ms[stage]) {
+		t->max_ms[stage] = ms;
+	}
+}
+
+//counts a finished frame, and once a second prints fps and each stage's average/worst time
+void headless_frame_done(headless_timing_t * t) {
+	double now = headless_now_ms();
+	double elapsed = now - t->window_start;
+	int s;
+
+	t->frames++;
+	if(elapsed < 1000) {
+		return;
+	}
+	if(t->report) {
+		fprintf(stderr, "[%s] %.1f fps", t->name, t->frames * 1000.0 / elapsed);
+		for(s=0;s<t->stages;s++) {
+			fprintf(stderr, " | %s %.2f/%.2f ms", t->stage_name[s], t->total_ms[s] / t->frames, t->max_ms[s]);
+		}
+		fprintf(stderr, "\n");
+	}
+	for(s=0;s<t->stages;s++) {
+		t->total_ms[s] = 0;
+		t->max_ms[s] = 0;
+	}
+	t->frames = 0;
+	t->window_start = now;
+}
+
+//a raw 11 bit depth frame of a slightly tilted floor with a mound circling over it
+//and a sprinkling of pixels without a reading, for running without a Kinect; the depths
+//lie between HEADLESS_SYNTHETIC_NEAR and HEADLESS_SYNTHETIC_FAR for frames up to 480 rows
+void headless_synthetic_depth(uint16_t * raw, int width, int height, unsigned frame) {
+	float cx = width/2 + width/4 * cosf(frame * 0.05f);
+	float cy = height/2 + height/4 * sinf(frame * 0.05f);
+	int x, y;
+
+	for(y=0;y<height;y++) {
+		for(x=0;x<width;x++) {
+			float dx = x - cx;
+			float dy = y - cy;
+			float r2 = (dx*dx + dy*dy) / (60.0f*60.0f);
+			int v = HEADLESS_SYNTHETIC_NEAR + 40 + y/8;
+			if(r2 < 1) {
+				v -= (int)(40 * (1 - r2));
+			}
+			if((x*7 + y*13 + frame) % 97 == 0) {
+				v = 2047;
+			}
+			raw[y*width + x] = (uint16_t)v;
+		}
+	}
+}
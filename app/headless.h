@@ -0,0 +1,121 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define HEADLESS_MAX_STAGES 8
+#define HEADLESS_SHM_SLOTS 4
+#define HEADLESS_SHM_MAGIC 0x4b54504f	//"KTPO"
+#define HEADLESS_SYNTHETIC_NEAR 800		//raw depth of the synthetic mound's top
+#define HEADLESS_SYNTHETIC_FAR 900		//raw depth past the synthetic floor's far edge
+
+/** headless_options_t
+	Command line switches shared by the apps, removed from argv once parsed:
+	--headless           run the pipeline without a window
+	--sink=SPEC          where headless frames go: ppm:PREFIX, shm:/NAME, stdout or none
+	--frames=N           stop after N frames have reached the sink
+	--synthetic          feed a generated depth stream instead of a Kinect
+	--calibrate          fit the base plane on the first frame (topography), with a typical
+	                     Kinect's tables when --synthetic
+**/
+typedef struct {
+	int enabled;
+	int synthetic;
+	int calibrate;
+	unsigned max_frames;
+	const char * sink_spec;
+} headless_options_t;
+
+/** headless_shm_header_t
+	Start of the shared memory ring, followed by HEADLESS_SHM_SLOTS frames of
+	width*height*3 bytes at 64 byte aligned offsets. Frame seq lives in slot
+	seq % slots. The writer zeroes slot_seq before copying a frame in and sets
+	it to seq afterwards, so a reader that sees the same nonzero slot_seq
+	before and after its copy has a whole frame.
+**/
+typedef struct {
+	uint32_t magic;
+	uint32_t width;
+	uint32_t height;
+	uint32_t slots;
+	uint32_t frame_offset;
+	_Atomic uint32_t latest;
+	_Atomic uint32_t slot_seq[HEADLESS_SHM_SLOTS];
+} headless_shm_header_t;
+
+typedef enum {
+	HEADLESS_SINK_NONE,
+	HEADLESS_SINK_PPM,
+	HEADLESS_SINK_SHM,
+	HEADLESS_SINK_STDOUT
+} headless_sink_kind;
+
+/** headless_sink_t
+	Destination for rendered RGB frames when there is no window.
+**/
+typedef struct {
+	headless_sink_kind kind;
+	int width;
+	int height;
+	unsigned written;
+	char prefix[256];
+	FILE * out;
+	int shm_fd;
+	char shm_name[64];
+	uint8_t * shm_map;
+	size_t shm_size;
+} headless_sink_t;
+
+/** headless_timing_t
+	Per stage timings for one thread, reported to stderr once a second.
+**/
+typedef struct {
+	const char * name;
+	int report;
+	int stages;
+	const char * stage_name[HEADLESS_MAX_STAGES];
+	double total_ms[HEADLESS_MAX_STAGES];
+	double max_ms[HEADLESS_MAX_STAGES];
+	unsigned frames;
+	double window_start;
+} headless_timing_t;
+
+void headless_parse_args(headless_options_t *, int *, char **);
+
+int headless_sink_open(headless_sink_t *, const char *, int, int);
+int headless_sink_write(headless_sink_t *, const uint8_t *, uint32_t);
+void headless_sink_close(headless_sink_t *);
+
+double headless_now_ms();
+void headless_timing_init(headless_timing_t *, const char *, int);
+int headless_stage(headless_timing_t *, const char *);
+void headless_time(headless_timing_t *, int, double);
+void headless_frame_done(headless_timing_t *);
+
+void headless_synthetic_depth(uint16_t *, int, int, unsigned);
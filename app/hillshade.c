@@ -0,0 +1,356 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "hillshade.h"
+
+#define HALF (HILLSHADE_STEPS / 2)
+#define NO_SLOT (COLOURMAP_SIZE - 1)
+//the level ground, lit as the palette has it
+#define FLAT (HALF * HILLSHADE_STEPS + HALF)
+#define TAPS (2 * HILLSHADE_RADIUS + 1)
+#define MEANS (2 * HILLSHADE_BASELINE + 1)
+//box rows from the top of the box above the first mean row shaded to the bottom of the one below it
+#define ROWS (TAPS + HILLSHADE_BASELINE)
+
+//frames up to width pixels wide, lit with the defaults; returns -1 if the rows can't be allocated
+int hillshade_init(hillshade_t * hs, int width) {
+	hs->azimuth = HILLSHADE_AZIMUTH;
+	hs->altitude = HILLSHADE_ALTITUDE;
+	hs->ambient = HILLSHADE_AMBIENT;
+	hs->exaggeration = HILLSHADE_EXAGGERATION;
+	hs->width = width;
+	hs->stride = width + 2 * HILLSHADE_REACH;
+	hs->rows = (int16_t *)malloc(ROWS * hs->stride * sizeof(int16_t));
+	hs->sums = (int32_t *)malloc(2 * hs->stride * sizeof(int32_t));
+	hs->means = (float *)malloc(MEANS * hs->stride * sizeof(float));
+	if(hs->rows == NULL || hs->sums == NULL || hs->means == NULL) {
+		hillshade_free(hs);
+		return -1;
+	}
+	hillshade_build(hs, 1.0f);
+	return 0;
+}
+
+void hillshade_free(hillshade_t * hs) {
+	free(hs->rows);
+	free(hs->sums);
+	free(hs->means);
+	hs->rows = NULL;
+	hs->sums = NULL;
+	hs->means = NULL;
+}
+
+//the light on every gradient, for pixels cell height units apart
+//a negative cell is for slots that grow away from the light, like raw depth
+void hillshade_build(hillshade_t * hs, float cell) {
+	//slope per unit of difference between means 2 * HILLSHADE_BASELINE apart
+	float scale = hs->exaggeration / (2.0f * HILLSHADE_BASELINE * cell);
+	float az = hs->azimuth * (float)M_PI / 180.0f;
+	float alt = hs->altitude * (float)M_PI / 180.0f;
+	//towards the light; x right, y down the frame, z up
+	float lx = sinf(az) * cosf(alt);
+	float ly = -cosf(az) * cosf(alt);
+	float lz = sinf(alt);
+	float flat = hs->ambient + (1.0f - hs->ambient) * lz;
+	int gx, gy;
+
+	//HALF steps each way cover slopes up to HILLSHADE_MAX_SLOPE
+	hs->step = HILLSHADE_MAX_SLOPE / (HALF * fabsf(scale));
+	scale *= hs->step;
+	for(gy=0;gy<HILLSHADE_STEPS;gy++) {
+		for(gx=0;gx<HILLSHADE_STEPS;gx++) {
+			float sx = (gx - HALF) * scale;
+			float sy = (gy - HALF) * scale;
+			float d = (-sx * lx - sy * ly + lz) / sqrtf(sx * sx + sy * sy + 1.0f);
+			float v = (hs->ambient + (1.0f - hs->ambient) * (d > 0 ? d : 0)) / flat;
+			hs->intensity[gy * HILLSHADE_STEPS + gx] = (uint16_t)lrintf(v * 256.0f);
+		}
+	}
+}
+
+//scales four packed colours by their light and writes them as 12 bytes of RGB
+static inline void shade4(const uint32_t * p, const uint16_t * light, uint8_t * rgb) {
+#if defined(__SSE2__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	__m128i zero = _mm_setzero_si128();
+	//each channel in the high byte of a 16 bit lane, so mulhi leaves channel * light / 256
+	__m128i lo = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, v),
+		_mm_set_epi16(light[1], light[1], light[1], light[1], light[0], light[0], light[0], light[0]));
+	__m128i hi = _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, v),
+		_mm_set_epi16(light[3], light[3], light[3], light[3], light[2], light[2], light[2], light[2]));
+	uint32_t q[4];
+	uint32_t w[3];
+	_mm_storeu_si128((__m128i *)q, _mm_packus_epi16(lo, hi));
+	w[0] = (q[0] & 0xffffff) | (q[1] << 24);
+	w[1] = ((q[1] >> 8) & 0xffff) | (q[2] << 16);
+	w[2] = ((q[2] >> 16) & 0xff) | (q[3] << 8);
+	memcpy(rgb, w, 12);
+#else
+	int k, c;
+	for(k=0;k<4;k++) {
+		for(c=0;c<3;c++) {
+			uint32_t v = ((p[k] >> (8*c)) & 0xff) * light[k] >> 8;
+			rgb[3*k+c] = (uint8_t)(v > 255 ? 255 : v);
+		}
+	}
+#endif
+}
+
+//fill4 for one pixel
+static inline float fill(float n, float across, float c) {
+	return isnan(n) ? c + c - (isnan(across) ? c : across) : n;
+}
+
+#if defined(__SSE2__)
+static inline __m128 select4(__m128 none, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(none, a), _mm_andnot_ps(none, b));
+}
+
+//neighbours with no heights around them take the centre's, so holes and margins don't read as cliffs;
+//where the one across the centre has heights the slope carries on through it instead
+static inline __m128 fill4(__m128 n, __m128 across, __m128 c) {
+	__m128 a = select4(_mm_cmpunord_ps(across, across), c, across);
+	return select4(_mm_cmpunord_ps(n, n), _mm_sub_ps(_mm_add_ps(c, c), a), n);
+}
+#endif
+
+//colours and shades n pixels of slots from rows of mean heights, up and down HILLSHADE_BASELINE rows
+//from mid; the rows reach HILLSHADE_BASELINE pixels past either end
+static void shade_row(const hillshade_t * hs, const uint32_t * lut, const float * up, const float * mid,
+		const float * down, const int16_t * slots, int n, uint8_t * rgb) {
+	const uint16_t * intensity = hs->intensity;
+	float per_step = 1.0f / hs->step;
+	int i = 0;
+	int k;
+
+#if defined(__SSE2__)
+	uint16_t index[8];
+	uint16_t light[8];
+	uint32_t p[8];
+	__m128 v_per_step = _mm_set1_ps(per_step);
+	__m128 v_low = _mm_set1_ps(-HALF);
+	__m128 v_high = _mm_set1_ps(HALF - 1);
+	__m128 v_half = _mm_set1_ps(HALF);
+	__m128i v_no_slot = _mm_set1_epi16(NO_SLOT);
+	__m128i v_flat = _mm_set1_epi16(FLAT);
+	__m128i q[2];
+	__m128i none;
+	for(;i+8<=n;i+=8) {
+		for(k=0;k<2;k++) {
+			__m128 l = _mm_loadu_ps(mid + i + 4*k - HILLSHADE_BASELINE);
+			__m128 r = _mm_loadu_ps(mid + i + 4*k + HILLSHADE_BASELINE);
+			__m128 u = _mm_loadu_ps(up + i + 4*k);
+			__m128 d = _mm_loadu_ps(down + i + 4*k);
+			__m128 gx = _mm_sub_ps(r, l);
+			__m128 gy = _mm_sub_ps(d, u);
+			//means with no readings are NaN and spoil the difference, only then are they filled
+			if(_mm_movemask_ps(_mm_cmpunord_ps(gx, gy))) {
+				__m128 c = _mm_loadu_ps(mid + i + 4*k);
+				gx = _mm_sub_ps(fill4(r, l, c), fill4(l, r, c));
+				gy = _mm_sub_ps(fill4(d, u, c), fill4(u, d, c));
+			}
+			gx = _mm_add_ps(_mm_min_ps(_mm_max_ps(_mm_mul_ps(gx, v_per_step), v_low), v_high), v_half);
+			gy = _mm_add_ps(_mm_min_ps(_mm_max_ps(_mm_mul_ps(gy, v_per_step), v_low), v_high), v_half);
+			q[k] = _mm_add_epi32(_mm_slli_epi32(_mm_cvtps_epi32(gy), 6), _mm_cvtps_epi32(gx));
+		}
+		//pixels with no reading are left as flat ground
+		none = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(slots + i)), v_no_slot);
+		_mm_storeu_si128((__m128i *)index,
+			_mm_or_si128(_mm_and_si128(none, v_flat), _mm_andnot_si128(none, _mm_packs_epi32(q[0], q[1]))));
+		for(k=0;k<8;k++) {
+			light[k] = intensity[index[k]];
+			p[k] = lut[slots[i + k]];
+		}
+		shade4(p, light, rgb + 3*i);
+		shade4(p + 4, light + 4, rgb + 3*i + 12);
+	}
+#endif
+	for(;i<n;i++) {
+		float c = mid[i];
+		float gx = fill(mid[i + HILLSHADE_BASELINE], mid[i - HILLSHADE_BASELINE], c)
+			- fill(mid[i - HILLSHADE_BASELINE], mid[i + HILLSHADE_BASELINE], c);
+		float gy = fill(down[i], up[i], c) - fill(up[i], down[i], c);
+		//NaN clamps to the low end as maxps leaves it, though only pixels with no reading get one
+		int qx = (int)lrintf(fminf(fmaxf(gx * per_step, -HALF), HALF - 1) + HALF);
+		int qy = (int)lrintf(fminf(fmaxf(gy * per_step, -HALF), HALF - 1) + HALF);
+		uint32_t light = intensity[slots[i] == NO_SLOT ? FLAT : qy * HILLSHADE_STEPS + qx];
+		uint32_t p = lut[slots[i]];
+		for(k=0;k<3;k++) {
+			uint32_t v = ((p >> (8*k)) & 0xff) * light >> 8;
+			rgb[3*i+k] = (uint8_t)(v > 255 ? 255 : v);
+		}
+	}
+}
+
+//the mean slot over the box around each of n columns; a box with no readings is 0 / 0, NaN
+static void box_row(const int32_t * sum, const int32_t * count, int n, float * mean) {
+	int i, k;
+	for(i=0;i<n;i++) {
+		int32_t s = 0;
+		int32_t c = 0;
+		for(k=0;k<TAPS;k++) {
+			s += sum[i + k];
+			c += count[i + k];
+		}
+		mean[i] = (float)s / (float)c;
+	}
+}
+
+//takes slot v's place in a column's sum and count of readings from old's
+#define SWAP_SLOT(c, old, v) do { \
+	int on_ = (v) != NO_SLOT; \
+	int was_ = (old) != NO_SLOT; \
+	sum[c] += on_ * (v) - was_ * (old); \
+	count[c] += on_ - was_; \
+} while(0)
+
+//the slot as far past an edge as b is inside it, from the slot a on the edge, carrying the slope on
+static inline int16_t extend(int16_t a, int16_t b) {
+	int v = 2 * a - b;
+	if(a == NO_SLOT || b == NO_SLOT) {
+		return NO_SLOT;
+	}
+	return (int16_t)(v < 0 ? 0 : (v >= NO_SLOT ? NO_SLOT - 1 : v));
+}
+
+//frame row r as slots into dst, columns left to left+n-1, taking its place in the column sums and
+//counts of readings from the row in gone, which may be dst. Past the frame's edges slots are extended
+//through them, so slopes run on and the light doesn't change at the edge
+#define SLOT_ROW(name, type, SLOT) \
+static inline int16_t name##_at(const type * row, int width, int x) { \
+	int e = x < 0 ? 0 : (x < width ? x : width - 1); \
+	int m = 2 * e - x; \
+	if(x == e) { \
+		return SLOT(row[x]); \
+	} \
+	return extend(SLOT(row[e]), SLOT(row[m < 0 ? 0 : (m < width ? m : width - 1)])); \
+} \
+static void name(const void * src, int width, int height, int r, int left, int n, const int16_t * gone, \
+		int16_t * dst, int32_t * sum, int32_t * count) { \
+	int e = r < 0 ? 0 : (r < height ? r : height - 1); \
+	int m = 2 * e - r; \
+	const type * row = (const type *)src + e * width; \
+	const type * across = (const type *)src + (m < 0 ? 0 : (m < height ? m : height - 1)) * width; \
+	int start = left < 0 ? -left : 0; \
+	int end = left + n > width ? width - left : n; \
+	int c; \
+	if(r != e) { \
+		for(c=0;c<n;c++) { \
+			int16_t v = extend(name##_at(row, width, left + c), name##_at(across, width, left + c)); \
+			SWAP_SLOT(c, gone[c], v); \
+			dst[c] = v; \
+		} \
+		return; \
+	} \
+	for(c=0;c<start;c++) { \
+		int16_t v = name##_at(row, width, left + c); \
+		SWAP_SLOT(c, gone[c], v); \
+		dst[c] = v; \
+	} \
+	for(;c<end;c++) { \
+		int16_t old = gone[c]; \
+		int16_t v = SLOT(row[left + c]); \
+		SWAP_SLOT(c, old, v); \
+		dst[c] = v; \
+	} \
+	for(;c<n;c++) { \
+		int16_t v = name##_at(row, width, left + c); \
+		SWAP_SLOT(c, gone[c], v); \
+		dst[c] = v; \
+	} \
+}
+
+#define DEPTH_SLOT(v) ((int16_t)((v) & (COLOURMAP_SIZE - 1)))
+//heights off the table are no reading, as in colour_lut_apply_height
+#define HEIGHT_SLOT(h) ((int16_t)((h) < -COLOURMAP_HEIGHT_ZERO || (h) >= COLOURMAP_SIZE - COLOURMAP_HEIGHT_ZERO \
+	? NO_SLOT : (h) + COLOURMAP_HEIGHT_ZERO))
+
+SLOT_ROW(depth_row, uint16_t, DEPTH_SLOT)
+SLOT_ROW(height_row, int16_t, HEIGHT_SLOT)
+
+typedef void (*slot_row_fn)(const void *, int, int, int, int, int, const int16_t *, int16_t *, int32_t *, int32_t *);
+
+//the w x h rectangle at x, y of a width x height frame. The box's column sums slide down a row at a
+//time, each frame row loaded once, and the means it leaves are kept until the rows they light are shaded
+static void shade_rect(hillshade_t * hs, const uint32_t * lut, slot_row_fn load, const void * src,
+		int width, int height, int x, int y, int w, int h, uint8_t * rgb) {
+	int stride = hs->stride;
+	int span = w + 2 * HILLSHADE_REACH;
+	int left = x - HILLSHADE_REACH;
+	int first = y - HILLSHADE_REACH;
+	int32_t * sum = hs->sums;
+	int32_t * count = hs->sums + stride;
+	int m, c;
+
+	//the box starts empty, each of its rows taking the place of one with no readings
+	memset(hs->sums, 0, 2 * stride * sizeof(int32_t));
+	for(m=0;m<TAPS;m++) {
+		for(c=0;c<span;c++) {
+			hs->rows[m * stride + c] = NO_SLOT;
+		}
+	}
+	for(m=first;m<first+TAPS-1;m++) {
+		int16_t * row = hs->rows + (m - first) * stride;
+		load(src, width, height, m, left, span, row, row, sum, count);
+	}
+	//the box around each mean row from HILLSHADE_BASELINE above the rectangle to as far below it
+	for(m=y-HILLSHADE_BASELINE;m<y+h+HILLSHADE_BASELINE;m++) {
+		//the row entering the box takes the place of the one leaving it
+		int16_t * row = hs->rows + ((m + HILLSHADE_RADIUS - first) % ROWS) * stride;
+		const int16_t * gone = m > y - HILLSHADE_BASELINE
+			? hs->rows + ((m - 1 - HILLSHADE_RADIUS - first) % ROWS) * stride : row;
+		load(src, width, height, m + HILLSHADE_RADIUS, left, span, gone, row, sum, count);
+		box_row(sum, count, w + 2 * HILLSHADE_BASELINE, hs->means + ((m - first) % MEANS) * stride);
+		if(m >= y + HILLSHADE_BASELINE) {
+			int r = m - HILLSHADE_BASELINE;
+			shade_row(hs, lut,
+				hs->means + ((r - HILLSHADE_BASELINE - first) % MEANS) * stride + HILLSHADE_BASELINE,
+				hs->means + ((r - first) % MEANS) * stride + HILLSHADE_BASELINE,
+				hs->means + ((m - first) % MEANS) * stride + HILLSHADE_BASELINE,
+				hs->rows + ((r - first) % ROWS) * stride + HILLSHADE_REACH, w,
+				rgb + 3 * (r * width + x));
+		}
+	}
+}
+
+//colourizes and shades a rectangle of raw depth or DEM slots into a packed RGB frame of the same size
+void hillshade_apply(hillshade_t * hs, const uint32_t * lut, const uint16_t * slots, int width, int height,
+		int x, int y, int w, int h, uint8_t * rgb) {
+	shade_rect(hs, lut, depth_row, slots, width, height, x, y, w, h, rgb);
+}
+
+//the same for signed heights in mm, colours as colourmap_apply_height
+void hillshade_apply_height(hillshade_t * hs, const uint32_t * lut, const int16_t * height_mm, int width, int height,
+		int x, int y, int w, int h, uint8_t * rgb) {
+	shade_rect(hs, lut, height_row, height_mm, width, height, x, y, w, h, rgb);
+}
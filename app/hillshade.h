@@ -0,0 +1,83 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "colourmap.h"
+
+#define HILLSHADE_AZIMUTH 315.0f		//degrees clockwise from the top of the frame, lit from the top left as maps are
+#define HILLSHADE_ALTITUDE 45.0f		//degrees above the horizon
+#define HILLSHADE_AMBIENT 0.35f			//share of the light that reaches slopes facing away
+#define HILLSHADE_EXAGGERATION 2.0f		//sandbox relief is low, steepen it for the light
+#define HILLSHADE_STEPS 64				//gradient slots per axis
+#define HILLSHADE_MAX_SLOPE 4.0f		//steeper slopes share the table's edge
+#define HILLSHADE_RADIUS 2				//heights are averaged over the box this far around a pixel
+#define HILLSHADE_BASELINE 4			//gradients are taken between the means this far either side
+#define HILLSHADE_REACH (HILLSHADE_RADIUS + HILLSHADE_BASELINE)	//pixels around a rectangle whose heights its shading reads
+
+/** hillshade_t
+	Relief shading for a colourized frame. Table slots are averaged over the
+	box HILLSHADE_RADIUS around each pixel, and its gradient is the difference
+	between the means HILLSHADE_BASELINE to either side (a height in slots is
+	offset by a constant, so the gradient is the height's). Depth comes in
+	whole slots; together the box and the baseline smooth their steps back
+	into the slope they quantize. Slots with no reading are left out of the
+	means, a neighbour with none around it takes the centre's mean, and
+	pixels with no reading keep their palette colour. The gradient, in steps,
+	picks the light on that slope from intensity, and the palette colour is
+	scaled by it in the same pass. A pixel's shading reads heights
+	up to HILLSHADE_REACH away, so a change repaints that far around it.
+	Colours come from COLOURMAP_SIZE slots, a colourmap_t's or those of a
+	colour_lut_t of that size with shift 0, heights taking slot
+	COLOURMAP_HEIGHT_ZERO + h.
+	The light and exaggeration take effect at the next hillshade_build.
+	intensity: [y gradient][x gradient] -> 1/256 of the palette colour, 256 on flat ground
+	step: difference between means per intensity slot
+	rows: rows of slots, HILLSHADE_REACH wider than the frame on each side
+	sums: the box's column sums and counts of readings
+	means: the rows of box means a row's gradients are taken over
+**/
+typedef struct {
+	float azimuth;
+	float altitude;
+	float ambient;
+	float exaggeration;
+	int width;
+	int stride;
+	float step;
+	uint16_t intensity[HILLSHADE_STEPS * HILLSHADE_STEPS];
+	int16_t * rows;
+	int32_t * sums;
+	float * means;
+} hillshade_t;
+
+int hillshade_init(hillshade_t *, int);
+void hillshade_free(hillshade_t *);
+void hillshade_build(hillshade_t *, float);
+void hillshade_apply(hillshade_t *, const uint32_t *, const uint16_t *, int, int, int, int, int, int, uint8_t *);
+void hillshade_apply_height(hillshade_t *, const uint32_t *, const int16_t *, int, int, int, int, int, int, uint8_t *);
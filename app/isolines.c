@@ -0,0 +1,568 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "isolines.h"
+
+//segments per cell case, as pairs of cell edges: 0 top, 1 right, 2 bottom, 3 left
+//corners above the level set bits 8 top left, 4 top right, 2 bottom right, 1 bottom left
+//the saddles 5 and 10 are listed for a mean above the level; with the mean below,
+//case 5 needs the segments of case 10 and the other way round
+static const int8_t cell_segments[16][4] = {
+	{-1,-1,-1,-1}, {3,2,-1,-1}, {2,1,-1,-1}, {3,1,-1,-1},
+	{0,1,-1,-1}, {3,0,2,1}, {0,2,-1,-1}, {3,0,-1,-1},
+	{0,3,-1,-1}, {0,2,-1,-1}, {0,1,3,2}, {0,1,-1,-1},
+	{3,1,-1,-1}, {1,2,-1,-1}, {3,2,-1,-1}, {-1,-1,-1,-1}
+};
+
+//next power of two capacity holding need, starting from cap
+static int grow_cap(int cap, int need) {
+	int n = cap > 0 ? cap : 1024;
+	while(n < need) {
+		n *= 2;
+	}
+	return n;
+}
+
+//reallocates *buf to count elements of size bytes, returns -1 and leaves *buf alone on failure
+static int resize(void * buf, int count, size_t size) {
+	void ** p = (void **)buf;
+	void * q = realloc(*p, (size_t)count * size);
+	if(q == NULL) {
+		return -1;
+	}
+	*p = q;
+	return 0;
+}
+
+void isoline_set_init(isoline_set_t * set) {
+	memset(set, 0, sizeof(*set));
+}
+
+void isoline_set_free(isoline_set_t * set) {
+	free(set->points);
+	free(set->strips);
+	isoline_set_init(set);
+}
+
+//makes room for points more points and strips more strips
+static int set_reserve(isoline_set_t * set, int points, int strips) {
+	if(set->point_count + points > set->point_cap) {
+		int cap = grow_cap(set->point_cap, set->point_count + points);
+		if(resize(&set->points, cap, 2 * sizeof(float)) < 0) {
+			return -1;
+		}
+		set->point_cap = cap;
+	}
+	if(set->strip_count + strips > set->strip_cap) {
+		int cap = grow_cap(set->strip_cap, set->strip_count + strips);
+		if(resize(&set->strips, cap, sizeof(isoline_strip_t)) < 0) {
+			return -1;
+		}
+		set->strip_cap = cap;
+	}
+	return 0;
+}
+
+int isoline_set_copy(isoline_set_t * dst, const isoline_set_t * src) {
+	dst->point_count = 0;
+	dst->strip_count = 0;
+	if(set_reserve(dst, src->point_count, src->strip_count) < 0) {
+		return -1;
+	}
+	memcpy(dst->points, src->points, (size_t)src->point_count * 2 * sizeof(float));
+	memcpy(dst->strips, src->strips, (size_t)src->strip_count * sizeof(isoline_strip_t));
+	dst->point_count = src->point_count;
+	dst->strip_count = src->strip_count;
+	return 0;
+}
+
+static void linker_free(isolines_linker_t * lk) {
+	free(lk->links);
+	free(lk->seen);
+	free(lk->hash_keys);
+	free(lk->hash_ends);
+	memset(lk, 0, sizeof(*lk));
+}
+
+static uint32_t hash_key(uint32_t k) {
+	k ^= k >> 15;
+	k *= 2654435761u;
+	return k ^ (k >> 13);
+}
+
+//pairs up the ends of pieces that carry the same key, links[end] becomes the joined end
+//keys holds two keys per piece, ISOLINES_NO_KEY ends are never joined
+static int link_ends(isolines_linker_t * lk, const uint32_t * keys, int pieces) {
+	int ends = pieces * 2;
+	int size = 64;
+	uint32_t mask;
+	int e;
+
+	while(size < ends * 2) {
+		size *= 2;
+	}
+	if(pieces > lk->piece_cap) {
+		int cap = grow_cap(lk->piece_cap, pieces);
+		if(resize(&lk->links, cap, 2 * sizeof(int32_t)) < 0 || resize(&lk->seen, cap, 1) < 0) {
+			return -1;
+		}
+		lk->piece_cap = cap;
+	}
+	if(size > lk->hash_cap) {
+		if(resize(&lk->hash_keys, size, sizeof(uint32_t)) < 0 || resize(&lk->hash_ends, size, sizeof(int32_t)) < 0) {
+			return -1;
+		}
+		lk->hash_cap = size;
+	}
+
+	memset(lk->hash_keys, 0xff, (size_t)size * sizeof(uint32_t));
+	mask = (uint32_t)size - 1;
+	for(e=0;e<ends;e++) {
+		uint32_t k = keys[e];
+		uint32_t h;
+
+		lk->links[e] = -1;
+		if(k == ISOLINES_NO_KEY) {
+			continue;
+		}
+		h = hash_key(k) & mask;
+		while(lk->hash_keys[h] != ISOLINES_NO_KEY && lk->hash_keys[h] != k) {
+			h = (h + 1) & mask;
+		}
+		if(lk->hash_keys[h] == k) {
+			int other = lk->hash_ends[h];
+			//a key is shared by two ends at most, a third is left open
+			if(lk->links[other] < 0) {
+				lk->links[other] = e;
+				lk->links[e] = other;
+			}
+		} else {
+			lk->hash_keys[h] = k;
+			lk->hash_ends[h] = e;
+		}
+	}
+	return 0;
+}
+
+typedef void (*piece_fn)(void *, int, int, int);
+typedef void (*run_fn)(void *, int, uint32_t, uint32_t);
+
+//follows the links into runs, handing each piece to piece(ctx, index, reversed, first in run)
+//in order and then closing the run with run(ctx, closed, key at its start, key at its end)
+static void walk_runs(isolines_linker_t * lk, const uint32_t * keys, int pieces,
+		piece_fn piece, run_fn run, void * ctx) {
+	const int32_t * links = lk->links;
+	uint8_t * seen = lk->seen;
+	int p;
+
+	memset(seen, 0, pieces);
+	for(p=0;p<pieces;p++) {
+		int s = p;
+		int s_in = 0;
+		int closed = 0;
+		int steps = 0;
+		int cur, in, out, first;
+		uint32_t first_key;
+
+		if(seen[p]) {
+			continue;
+		}
+		//back up to the start of the run, or all the way round a loop
+		while(links[s * 2 + s_in] >= 0 && steps++ < pieces) {
+			int m = links[s * 2 + s_in];
+			if(m >> 1 == p) {
+				closed = 1;
+				s = p;
+				s_in = 0;
+				break;
+			}
+			s = m >> 1;
+			s_in = (m & 1) ^ 1;
+		}
+
+		first_key = keys[s * 2 + s_in];
+		cur = s;
+		in = s_in;
+		first = 1;
+		while(1) {
+			int m;
+			seen[cur] = 1;
+			piece(ctx, cur, in, first);
+			first = 0;
+			out = cur * 2 + (in ^ 1);
+			m = links[out];
+			if(m < 0 || seen[m >> 1]) {
+				break;
+			}
+			cur = m >> 1;
+			in = m & 1;
+		}
+		if(closed) {
+			run(ctx, 1, ISOLINES_NO_KEY, ISOLINES_NO_KEY);
+		} else {
+			run(ctx, 0, first_key, keys[out]);
+		}
+	}
+}
+
+int isolines_init(isolines_t * iso, int width, int height, workers_t * pool) {
+	memset(iso, 0, sizeof(*iso));
+	iso->width = width;
+	iso->height = height;
+	iso->pool = pool;
+	iso->band_count = pool != NULL ? pool->count : 1;
+	iso->bands = (isolines_band_t *)calloc(iso->band_count, sizeof(isolines_band_t));
+	if(iso->bands == NULL) {
+		return -1;
+	}
+	isolines_set_levels(iso, 0, 1, 1);
+	return 0;
+}
+
+void isolines_free(isolines_t * iso) {
+	int i;
+	for(i=0;i<iso->band_count && iso->bands != NULL;i++) {
+		isolines_band_t * band = &iso->bands[i];
+		free(band->segment_keys);
+		free(band->segment_points);
+		linker_free(&band->linker);
+		isoline_set_free(&band->chains);
+		free(band->chain_keys);
+	}
+	free(iso->bands);
+	iso->bands = NULL;
+	linker_free(&iso->linker);
+	free(iso->chain_keys);
+	free(iso->chain_band);
+	free(iso->chain_index);
+	iso->chain_keys = NULL;
+	iso->chain_band = NULL;
+	iso->chain_index = NULL;
+	iso->chain_cap = 0;
+	isoline_set_free(&iso->lines);
+}
+
+//lines at start, start + interval, ... for levels levels
+void isolines_set_levels(isolines_t * iso, float start, float interval, int levels) {
+	//keys are level * edges + edge and have to stay below ISOLINES_NO_KEY
+	uint32_t edges = 2u * iso->width * iso->height;
+	int max_levels = (int)((ISOLINES_NO_KEY - 1) / (edges > 0 ? edges : 1));
+
+	iso->start = start;
+	iso->interval = interval > 0 ? interval : 1;
+	iso->levels = levels < 1 ? 1 : (levels > max_levels ? max_levels : levels);
+}
+
+typedef struct {
+	isolines_band_t * band;
+	uint32_t edges;
+	int run_start;
+	int run_level;
+} band_walk_t;
+
+static void band_piece(void * arg, int piece, int reversed, int first) {
+	band_walk_t * w = (band_walk_t *)arg;
+	isoline_set_t * set = &w->band->chains;
+	const float * pt = w->band->segment_points + piece * 4;
+	float * out = set->points + set->point_count * 2;
+
+	if(first) {
+		w->run_start = set->point_count;
+		w->run_level = (int)(w->band->segment_keys[piece * 2] / w->edges);
+		out[0] = pt[reversed ? 2 : 0];
+		out[1] = pt[reversed ? 3 : 1];
+		out += 2;
+		set->point_count++;
+	}
+	out[0] = pt[reversed ? 0 : 2];
+	out[1] = pt[reversed ? 1 : 3];
+	set->point_count++;
+}
+
+static void band_run(void * arg, int closed, uint32_t first_key, uint32_t last_key) {
+	band_walk_t * w = (band_walk_t *)arg;
+	isoline_set_t * set = &w->band->chains;
+	isoline_strip_t * strip = &set->strips[set->strip_count];
+
+	strip->start = w->run_start;
+	strip->count = set->point_count - w->run_start;
+	strip->level = w->run_level;
+	strip->closed = closed;
+	w->band->chain_keys[set->strip_count * 2] = first_key;
+	w->band->chain_keys[set->strip_count * 2 + 1] = last_key;
+	set->strip_count++;
+}
+
+//level k, worked out the same way wherever it is compared against corners
+static inline float level_at(float start, float interval, int k) {
+	return start + k * interval;
+}
+
+//marching squares over one band of cell rows, then links its segments into chains
+static void extract_band(void * arg, int index, int count) {
+	isolines_t * iso = (isolines_t *)arg;
+	isolines_band_t * band = &iso->bands[index];
+	const uint16_t * field = iso->field;
+	int width = iso->width;
+	int y0 = (iso->height - 1) * index / count;
+	int y1 = (iso->height - 1) * (index + 1) / count;
+	uint32_t edges = 2u * width * iso->height;
+	uint16_t invalid = iso->invalid;
+	float start = iso->start;
+	float interval = iso->interval;
+	float inv_interval = 1.0f / interval;
+	int levels = iso->levels;
+	band_walk_t walk;
+	int x, y, k, j;
+
+	band->segment_count = 0;
+	band->chains.point_count = 0;
+	band->chains.strip_count = 0;
+	band->failed = 0;
+	for(y=y0;y<y1;y++) {
+		const uint16_t * row = field + y * width;
+		const uint16_t * next = row + width;
+		for(x=0;x<width-1;x++) {
+			int a = row[x], b = row[x + 1], c = next[x + 1], d = next[x];
+			int lo = a < b ? a : b;
+			int hi = a < b ? b : a;
+			int k0, k1;
+			float fa, fb, fc, fd, mean;
+
+			lo = c < lo ? c : lo;
+			lo = d < lo ? d : lo;
+			hi = c > hi ? c : hi;
+			hi = d > hi ? d : hi;
+			//flat cells are the common case, nothing crosses them
+			if(lo == hi || a == invalid || b == invalid || c == invalid || d == invalid) {
+				continue;
+			}
+			//levels with lo < level <= hi; the reciprocal can land a level off when a corner sits
+			//right on one, so the guess is settled against the levels themselves
+			k0 = (int)((lo - start) * inv_interval) + 1;
+			k1 = (int)((hi - start) * inv_interval);
+			while(k0 > 0 && level_at(start, interval, k0 - 1) > lo) {
+				k0--;
+			}
+			while(level_at(start, interval, k0) <= lo) {
+				k0++;
+			}
+			while(level_at(start, interval, k1) > hi) {
+				k1--;
+			}
+			while(level_at(start, interval, k1 + 1) <= hi) {
+				k1++;
+			}
+			k0 = k0 > 0 ? k0 : 0;
+			k1 = k1 < levels - 1 ? k1 : levels - 1;
+			if(k0 > k1) {
+				continue;
+			}
+			if(band->segment_count + 2 * (k1 - k0 + 1) > band->segment_cap) {
+				int cap = grow_cap(band->segment_cap, band->segment_count + 2 * (k1 - k0 + 1));
+				if(resize(&band->segment_keys, cap, 2 * sizeof(uint32_t)) < 0
+						|| resize(&band->segment_points, cap, 4 * sizeof(float)) < 0) {
+					band->failed = 1;
+					return;
+				}
+				band->segment_cap = cap;
+			}
+			fa = a; fb = b; fc = c; fd = d;
+			mean = (fa + fb + fc + fd) * 0.25f;
+			for(k=k0;k<=k1;k++) {
+				float level = level_at(start, interval, k);
+				int cell = (a >= level) << 3 | (b >= level) << 2 | (c >= level) << 1 | (d >= level);
+				const int8_t * seg;
+				uint32_t base = k * edges;
+
+				if((cell == 5 || cell == 10) && mean < level) {
+					cell ^= 15;
+				}
+				seg = cell_segments[cell];
+				for(j=0;j<4 && seg[j] >= 0;j++) {
+					int n = band->segment_count * 2 + (j & 1);
+					uint32_t * key = band->segment_keys + n;
+					float * pt = band->segment_points + n * 2;
+					//both cells sharing an edge interpolate it from the same two corners
+					switch(seg[j]) {
+					case 0:
+						*key = base + (y * width + x) * 2;
+						pt[0] = x + (level - fa) / (fb - fa);
+						pt[1] = y;
+						break;
+					case 1:
+						*key = base + (y * width + x + 1) * 2 + 1;
+						pt[0] = x + 1;
+						pt[1] = y + (level - fb) / (fc - fb);
+						break;
+					case 2:
+						*key = base + ((y + 1) * width + x) * 2;
+						pt[0] = x + (level - fd) / (fc - fd);
+						pt[1] = y + 1;
+						break;
+					case 3:
+						*key = base + (y * width + x) * 2 + 1;
+						pt[0] = x;
+						pt[1] = y + (level - fa) / (fd - fa);
+						break;
+					}
+					if(j & 1) {
+						band->segment_count++;
+					}
+				}
+			}
+		}
+	}
+
+	//a chain is at least one segment, so the segment count bounds everything
+	if(band->segment_count > band->chain_key_cap) {
+		int cap = grow_cap(band->chain_key_cap, band->segment_count);
+		if(resize(&band->chain_keys, cap, 2 * sizeof(uint32_t)) < 0) {
+			band->failed = 1;
+			return;
+		}
+		band->chain_key_cap = cap;
+	}
+	if(set_reserve(&band->chains, band->segment_count * 2, band->segment_count) < 0
+			|| link_ends(&band->linker, band->segment_keys, band->segment_count) < 0) {
+		band->failed = 1;
+		return;
+	}
+	walk.band = band;
+	walk.edges = edges;
+	walk_runs(&band->linker, band->segment_keys, band->segment_count, band_piece, band_run, &walk);
+}
+
+typedef struct {
+	isolines_t * iso;
+	int run_start;
+	int run_level;
+	int run_closed;		//a single chain that closed inside its band
+} stitch_walk_t;
+
+static void stitch_piece(void * arg, int piece, int reversed, int first) {
+	stitch_walk_t * w = (stitch_walk_t *)arg;
+	isoline_set_t * set = &w->iso->lines;
+	const isoline_set_t * chains = &w->iso->bands[w->iso->chain_band[piece]].chains;
+	const isoline_strip_t * chain = &chains->strips[w->iso->chain_index[piece]];
+	const float * src = chains->points + chain->start * 2;
+	float * out = set->points + set->point_count * 2;
+	int i, n = chain->count;
+
+	if(first) {
+		w->run_start = set->point_count;
+		w->run_level = chain->level;
+		w->run_closed = chain->closed;
+	}
+	//the joint point is already there from the previous chain
+	for(i=first?0:1;i<n;i++) {
+		int s = reversed ? n - 1 - i : i;
+		*out++ = src[s * 2];
+		*out++ = src[s * 2 + 1];
+	}
+	set->point_count += first ? n : n - 1;
+}
+
+static void stitch_run(void * arg, int closed, uint32_t first_key, uint32_t last_key) {
+	stitch_walk_t * w = (stitch_walk_t *)arg;
+	isoline_set_t * set = &w->iso->lines;
+	isoline_strip_t * strip = &set->strips[set->strip_count++];
+
+	strip->start = w->run_start;
+	strip->count = set->point_count - w->run_start;
+	strip->level = w->run_level;
+	strip->closed = closed || w->run_closed;
+}
+
+//joins chains that carry on across band boundaries into the final lines
+static int stitch_bands(isolines_t * iso) {
+	int chains = 0;
+	int points = 0;
+	int b, i, n;
+
+	iso->lines.point_count = 0;
+	iso->lines.strip_count = 0;
+	for(b=0;b<iso->band_count;b++) {
+		if(iso->bands[b].failed) {
+			return -1;
+		}
+		chains += iso->bands[b].chains.strip_count;
+		points += iso->bands[b].chains.point_count;
+	}
+	if(chains > iso->chain_cap) {
+		int cap = grow_cap(iso->chain_cap, chains);
+		if(resize(&iso->chain_keys, cap, 2 * sizeof(uint32_t)) < 0
+				|| resize(&iso->chain_band, cap, sizeof(int)) < 0
+				|| resize(&iso->chain_index, cap, sizeof(int)) < 0) {
+			return -1;
+		}
+		iso->chain_cap = cap;
+	}
+	if(set_reserve(&iso->lines, points, chains) < 0) {
+		return -1;
+	}
+
+	n = 0;
+	for(b=0;b<iso->band_count;b++) {
+		isolines_band_t * band = &iso->bands[b];
+		for(i=0;i<band->chains.strip_count;i++) {
+			iso->chain_keys[n * 2] = band->chain_keys[i * 2];
+			iso->chain_keys[n * 2 + 1] = band->chain_keys[i * 2 + 1];
+			iso->chain_band[n] = b;
+			iso->chain_index[n] = i;
+			n++;
+		}
+	}
+	if(link_ends(&iso->linker, iso->chain_keys, n) < 0) {
+		return -1;
+	}
+	{
+		stitch_walk_t walk;
+		walk.iso = iso;
+		walk_runs(&iso->linker, iso->chain_keys, n, stitch_piece, stitch_run, &walk);
+	}
+	return 0;
+}
+
+//extracts the lines of every level from a width*height field into iso->lines
+//returns the number of lines, or -1 when out of memory
+int isolines_extract(isolines_t * iso, const uint16_t * field, uint16_t invalid) {
+	iso->field = field;
+	iso->invalid = invalid;
+	if(iso->pool != NULL) {
+		workers_run(iso->pool, extract_band, iso);
+	} else {
+		extract_band(iso, 0, 1);
+	}
+	iso->field = NULL;
+	if(stitch_bands(iso) < 0) {
+		return -1;
+	}
+	return iso->lines.strip_count;
+}
@@ -0,0 +1,128 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "workers.h"
+
+#define ISOLINES_NO_KEY 0xffffffffu
+
+/** isoline_strip_t
+	One connected contour line, count points from points[2*start] on.
+	level: index of the iso value, start + level * interval
+	closed: the last point repeats the first
+**/
+typedef struct {
+	int start;
+	int count;
+	int level;
+	int closed;
+} isoline_strip_t;
+
+/** isoline_set_t
+	Polylines as x,y float pairs in pixel coordinates (pixel centres on whole
+	numbers), ready for glDrawArrays(GL_LINE_STRIP) one strip at a time.
+	Buffers grow as needed and are kept between frames.
+**/
+typedef struct {
+	float * points;
+	int point_count;
+	int point_cap;
+	isoline_strip_t * strips;
+	int strip_count;
+	int strip_cap;
+} isoline_set_t;
+
+/** isolines_linker_t
+	Scratch for joining pieces (segments, or chains of them) that share an
+	end key into runs. Every key is shared by at most two pieces.
+**/
+typedef struct {
+	int32_t * links;		//2 per piece, the piece end joined to each end, -1 if open
+	uint8_t * seen;
+	int piece_cap;
+	uint32_t * hash_keys;
+	int32_t * hash_ends;
+	int hash_cap;
+} isolines_linker_t;
+
+/** isolines_band_t
+	A worker's share of the field: the cell rows it runs marching squares
+	over, its segments, and the chains it links them into.
+	Chains stopping on the band's top or bottom row keep the key of that
+	crossing so they can be stitched to the neighbouring band.
+**/
+typedef struct {
+	int segment_count;
+	int segment_cap;
+	uint32_t * segment_keys;	//2 per segment, one per end
+	float * segment_points;		//4 per segment
+	isolines_linker_t linker;
+	isoline_set_t chains;
+	uint32_t * chain_keys;		//2 per chain, ISOLINES_NO_KEY on closed chains
+	int chain_key_cap;
+	int failed;
+} isolines_band_t;
+
+/** isolines_t
+	Marching squares contour extraction over a 16 bit field.
+	Levels sit at start + k * interval for k in 0..levels-1, a corner counts
+	as above a level when it is >= the level, and cells touching an invalid
+	sample produce no lines. Saddles are resolved by the cell's mean.
+	Each worker extracts and links a band of rows, then the band chains are
+	stitched on the calling thread into lines.
+**/
+typedef struct {
+	int width;
+	int height;
+	float start;
+	float interval;
+	int levels;
+	uint16_t invalid;
+	const uint16_t * field;	//only valid during isolines_extract
+
+	workers_t * pool;
+	int band_count;
+	isolines_band_t * bands;
+	//stitching scratch, over every band's chains
+	isolines_linker_t linker;
+	uint32_t * chain_keys;
+	int * chain_band;
+	int * chain_index;
+	int chain_cap;
+
+	isoline_set_t lines;
+} isolines_t;
+
+int isolines_init(isolines_t *, int, int, workers_t *);
+void isolines_free(isolines_t *);
+void isolines_set_levels(isolines_t *, float, float, int);
+int isolines_extract(isolines_t *, const uint16_t *, uint16_t);
+
+void isoline_set_init(isoline_set_t *);
+void isoline_set_free(isoline_set_t *);
+int isoline_set_copy(isoline_set_t *, const isoline_set_t *);
@@ -0,0 +1,218 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "occlusion.h"
+
+//pixels classified per block, the distances of a block stay in cache between the two passes
+#define OCCLUSION_BLOCK 1024
+
+//the usual fit of raw disparity to distance, until a calibration brings the camera's own table
+static void default_mm(float * mm) {
+	int i;
+	for(i=0;i<2048;i++) {
+		float z = 123.6f * tanf(i / 2842.5f + 1.1863f);
+		mm[i] = (i < OCCLUSION_INVALID_DEPTH && z > 0 && z < 10000.0f) ? z : 0;
+	}
+}
+
+//count pixels, with the default disparity table; returns -1 if the buffers can't be allocated
+int occlusion_init(occlusion_t * o, int count) {
+	o->count = count;
+	o->above_mm = OCCLUSION_ABOVE_MM;
+	o->rise_mm = OCCLUSION_RISE_MM;
+	o->settle_frames = OCCLUSION_SETTLE_FRAMES;
+	o->alpha = OCCLUSION_ALPHA;
+	o->mean = (float *)malloc(count * sizeof(float));
+	o->var = (float *)malloc(count * sizeof(float));
+	o->last = (float *)malloc(count * sizeof(float));
+	o->z = (float *)malloc(OCCLUSION_BLOCK * sizeof(float));
+	o->sand = (uint16_t *)malloc(count * sizeof(uint16_t));
+	o->held = (float *)malloc(count * sizeof(float));
+	o->mask = (uint8_t *)malloc(count);
+	if(o->mean == NULL || o->var == NULL || o->last == NULL || o->z == NULL
+			|| o->sand == NULL || o->held == NULL || o->mask == NULL) {
+		occlusion_free(o);
+		return -1;
+	}
+	default_mm(o->mm);
+	occlusion_reset(o);
+	return 0;
+}
+
+void occlusion_free(occlusion_t * o) {
+	free(o->mean);
+	free(o->var);
+	free(o->last);
+	free(o->z);
+	free(o->sand);
+	free(o->held);
+	free(o->mask);
+	o->mean = NULL;
+	o->var = NULL;
+	o->last = NULL;
+	o->z = NULL;
+	o->sand = NULL;
+	o->held = NULL;
+	o->mask = NULL;
+}
+
+//switches to the camera's own raw -> mm table, the model starts over in the new units
+void occlusion_set_mm(occlusion_t * o, const float * mm) {
+	memcpy(o->mm, mm, sizeof(o->mm));
+	occlusion_reset(o);
+}
+
+//forgets the background, the next frame is taken as bare sand
+void occlusion_reset(occlusion_t * o) {
+	int i;
+
+	o->primed = 0;
+	memset(o->mask, 0, o->count);
+	for(i=0;i<o->count;i++) {
+		o->sand[i] = OCCLUSION_INVALID_DEPTH;
+	}
+}
+
+//classifies one block of distances z against the model from pixel i0 on, four pixels at a time
+//with selects in place of branches; pixels without a reading (z 0) change nothing
+static void classify_block(occlusion_t * restrict o, const float * restrict z, int i0, int n) {
+	float * restrict mean = o->mean + i0;
+	float * restrict var = o->var + i0;
+	float * restrict last = o->last + i0;
+	float * restrict held = o->held + i0;
+	float above = o->above_mm;
+	float rise_mm = o->rise_mm;
+	float alpha = o->alpha;
+	float settle = (float)o->settle_frames;
+	int i = 0;
+
+#if defined(__SSE2__)
+	__m128 v_above = _mm_set1_ps(above);
+	__m128 v_rise = _mm_set1_ps(rise_mm);
+	__m128 v_fall = _mm_set1_ps(-rise_mm);
+	__m128 v_alpha = _mm_set1_ps(alpha);
+	__m128 v_settle = _mm_set1_ps(settle);
+	__m128 v_nine = _mm_set1_ps(9.0f);
+	__m128 v_one = _mm_set1_ps(1.0f);
+	__m128 v_none = _mm_set1_ps(-1.0f);
+	__m128 v_zero = _mm_setzero_ps();
+	#define SELECT(mask, a, b) _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b))
+	for(;i+4<=n;i+=4) {
+		__m128 zi = _mm_loadu_ps(z + i);
+		__m128 mn = _mm_loadu_ps(mean + i);
+		__m128 vr = _mm_loadu_ps(var + i);
+		__m128 ls = _mm_loadu_ps(last + i);
+		__m128 hd = _mm_loadu_ps(held + i);
+		__m128 d = _mm_sub_ps(mn, zi);
+		__m128 rise = _mm_sub_ps(ls, zi);
+		__m128 e = _mm_sub_ps(zi, mn);
+		__m128 seen = _mm_cmpgt_ps(zi, v_zero);
+		__m128 steady = _mm_and_ps(_mm_cmplt_ps(rise, v_rise), _mm_cmpgt_ps(rise, v_fall));
+		__m128 still = _mm_and_ps(steady, _mm_add_ps(hd, v_one));
+		__m128 stays = _mm_or_ps(_mm_cmpge_ps(hd, v_zero), _mm_cmpgt_ps(rise, v_rise));
+		__m128 high = _mm_and_ps(_mm_cmpgt_ps(d, v_above), _mm_cmpgt_ps(_mm_mul_ps(d, d), _mm_mul_ps(v_nine, vr)));
+		__m128 settled = _mm_cmpge_ps(still, v_settle);
+		__m128 occluded = _mm_andnot_ps(settled, _mm_and_ps(stays, high));
+		__m128 update = _mm_andnot_ps(occluded, seen);
+		__m128 dug = _mm_cmpgt_ps(e, v_above);
+		__m128 m = SELECT(dug, zi, _mm_add_ps(mn, _mm_mul_ps(v_alpha, e)));
+		__m128 v = SELECT(dug, vr, _mm_add_ps(vr, _mm_mul_ps(v_alpha, _mm_sub_ps(_mm_mul_ps(e, e), vr))));
+		m = SELECT(settled, zi, m);
+		v = _mm_andnot_ps(settled, v);
+		_mm_storeu_ps(mean + i, SELECT(update, m, mn));
+		_mm_storeu_ps(var + i, SELECT(update, v, vr));
+		_mm_storeu_ps(held + i, SELECT(seen, SELECT(occluded, still, v_none), hd));
+		_mm_storeu_ps(last + i, SELECT(seen, zi, ls));
+	}
+	#undef SELECT
+#endif
+	//the same, a pixel at a time; conditions are combined with & rather than &&
+	for(;i<n;i++) {
+		float zi = z[i];
+		float d = mean[i] - zi;
+		float rise = last[i] - zi;
+		float e = zi - mean[i];
+		int seen = zi > 0;
+		//held counts the frames a pixel has been occluded without moving, -1 when it isn't occluded
+		float still = ((rise < rise_mm) & (rise > -rise_mm)) ? held[i] + 1.0f : 0.0f;
+		int stays = (held[i] >= 0) | (rise > rise_mm);
+		int high = (d > above) & (d * d > 9.0f * var[i]);
+		int settled = still >= settle;
+		float h = (stays & high & !settled) ? still : -1.0f;
+		int update = seen & (h < 0);
+		//sand under an occluder is left as it was, sand dug away is followed at once
+		int dug = e > above;
+		float m = dug ? zi : mean[i] + alpha * e;
+		float v = dug ? var[i] : var[i] + alpha * (e * e - var[i]);
+		m = settled ? zi : m;
+		v = settled ? 0.0f : v;
+		mean[i] = update ? m : mean[i];
+		var[i] = update ? v : var[i];
+		held[i] = seen ? h : held[i];
+		last[i] = seen ? zi : last[i];
+	}
+}
+
+//writes raw with the occluded pixels replaced by the sand last seen under them, in may equal out
+//pixels without a reading pass through unless they are under an occluder
+void occlusion_apply(occlusion_t * o, const uint16_t * in, uint16_t * out) {
+	int i0, i, n;
+
+	for(i0=0;i0<o->count;i0+=OCCLUSION_BLOCK) {
+		n = o->count - i0 < OCCLUSION_BLOCK ? o->count - i0 : OCCLUSION_BLOCK;
+		for(i=0;i<n;i++) {
+			o->z[i] = o->mm[in[i0 + i] & 2047];
+		}
+		if(!o->primed) {
+			//the first frame is all sand
+			for(i=0;i<n;i++) {
+				o->mean[i0 + i] = o->z[i];
+				o->var[i0 + i] = 0;
+				o->last[i0 + i] = o->z[i];
+				o->held[i0 + i] = -1.0f;
+			}
+		} else {
+			classify_block(o, o->z, i0, n);
+		}
+		for(i=0;i<n;i++) {
+			uint16_t raw = in[i0 + i];
+			int keep = o->held[i0 + i] >= 0;
+			o->mask[i0 + i] = keep ? OCCLUSION_MASK_ON : 0;
+			//a hole in the sand doesn't replace the last reading of it
+			o->sand[i0 + i] = (keep | (raw >= OCCLUSION_INVALID_DEPTH)) ? o->sand[i0 + i] : raw;
+			out[i0 + i] = keep ? o->sand[i0 + i] : raw;
+		}
+	}
+	o->primed = 1;
+}
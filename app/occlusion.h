@@ -0,0 +1,70 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define OCCLUSION_INVALID_DEPTH 2047
+#define OCCLUSION_ABOVE_MM 25.0f		//closer than the sand by this much, and three deviations, to be a hand
+#define OCCLUSION_RISE_MM 8.0f		//rise in one frame that counts as something arriving
+#define OCCLUSION_SETTLE_FRAMES 90	//frames an unmoving occluder takes to be taken for sand
+#define OCCLUSION_ALPHA 0.05f		//how fast the background follows the sand
+#define OCCLUSION_MASK_ON 255
+
+/** occlusion_t
+	Per pixel background model of the sand, for keeping hands and arms out of
+	the height field. The background is a running distance and variance in mm.
+	A pixel is occluded once it rises more than rise_mm in a frame to more than
+	above_mm (and three deviations) closer than the background. It stays
+	occluded while it is that far above, showing the last raw depth of the sand
+	under it, until it has sat still for settle_frames and is taken as new sand.
+	Sand dug away by more than above_mm is followed at once, other change at alpha.
+	mm: raw 11 bit depth -> distance from the camera, 0 for no reading
+	mask: OCCLUSION_MASK_ON where the last frame was occluded, for debugging
+**/
+typedef struct {
+	int count;
+	float above_mm;
+	float rise_mm;
+	int settle_frames;
+	float alpha;
+	int primed;
+	float mm[2048];
+	float * mean;
+	float * var;
+	float * last;
+	float * z;			//one block of this frame's distances
+	float * held;		//frames occluded and still, -1 for sand
+	uint16_t * sand;
+	uint8_t * mask;
+} occlusion_t;
+
+int occlusion_init(occlusion_t *, int);
+void occlusion_free(occlusion_t *);
+void occlusion_set_mm(occlusion_t *, const float *);
+void occlusion_reset(occlusion_t *);
+void occlusion_apply(occlusion_t *, const uint16_t *, uint16_t *);
@@ -0,0 +1,247 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "projector.h"
+
+int projector_init(projector_t * p, int src_width, int src_height, int width, int height) {
+	memset(p, 0, sizeof(*p));
+	p->src_width = src_width;
+	p->src_height = src_height;
+	p->width = width;
+	p->height = height;
+	p->map = (projector_tap_t *)calloc(width * height, sizeof(projector_tap_t));
+	return p->map == NULL ? -1 : 0;
+}
+
+void projector_free(projector_t * p) {
+	free(p->map);
+	p->map = NULL;
+	p->valid = 0;
+}
+
+//solves the 8x8 system a * x = b in place by Gaussian elimination with partial pivoting, returns -1 if singular
+static int solve8(double a[8][9]) {
+	int r, c, k;
+	for(c=0;c<8;c++) {
+		int pivot = c;
+		for(r=c+1;r<8;r++) {
+			if(fabs(a[r][c]) > fabs(a[pivot][c])) {
+				pivot = r;
+			}
+		}
+		if(fabs(a[pivot][c]) < 1e-12) {
+			return -1;
+		}
+		if(pivot != c) {
+			for(k=0;k<9;k++) {
+				double t = a[c][k];
+				a[c][k] = a[pivot][k];
+				a[pivot][k] = t;
+			}
+		}
+		for(r=0;r<8;r++) {
+			double f;
+			if(r == c) {
+				continue;
+			}
+			f = a[r][c] / a[c][c];
+			for(k=c;k<9;k++) {
+				a[r][k] -= f * a[c][k];
+			}
+		}
+	}
+	for(r=0;r<8;r++) {
+		a[r][8] /= a[r][r];
+	}
+	return 0;
+}
+
+//fits the homography taking the projector's corners onto corners (camera pixels) and rebuilds the lookup
+//returns 0 on success, -1 for degenerate corners (the previous mapping is kept)
+int projector_set_corners(projector_t * p, float corners[4][2]) {
+	double proj[4][2] = {{0, 0}, {p->width, 0}, {p->width, p->height}, {0, p->height}};
+	double a[8][9];
+	double * h = p->homography;
+	int i, x, y;
+
+	for(i=0;i<4;i++) {
+		double px = proj[i][0], py = proj[i][1];
+		double u = corners[i][0], v = corners[i][1];
+		double row_u[9] = {px, py, 1, 0, 0, 0, -px*u, -py*u, u};
+		double row_v[9] = {0, 0, 0, px, py, 1, -px*v, -py*v, v};
+		memcpy(a[2*i], row_u, sizeof(row_u));
+		memcpy(a[2*i+1], row_v, sizeof(row_v));
+	}
+	if(solve8(a) < 0) {
+		return -1;
+	}
+	for(i=0;i<8;i++) {
+		h[i] = a[i][8];
+	}
+	h[8] = 1;
+	memcpy(p->corners, corners, sizeof(p->corners));
+
+	for(y=0;y<p->height;y++) {
+		for(x=0;x<p->width;x++) {
+			projector_tap_t * tap = &p->map[y*p->width + x];
+			double px = x + 0.5, py = y + 0.5;
+			double z = h[6]*px + h[7]*py + h[8];
+			//sample position with camera pixel centres on integers
+			double sx = (h[0]*px + h[1]*py + h[2]) / z - 0.5;
+			double sy = (h[3]*px + h[4]*py + h[5]) / z - 0.5;
+			int x0, y0, fx, fy;
+
+			memset(tap, 0, sizeof(*tap));
+			if(z <= 0 || sx < 0 || sy < 0 || sx > p->src_width - 1 || sy > p->src_height - 1) {
+				continue;
+			}
+			//keep the 2x2 neighbourhood inside the frame, the last row/column gets weight 16/16
+			x0 = (int)sx;
+			y0 = (int)sy;
+			x0 = x0 > p->src_width - 2 ? p->src_width - 2 : x0;
+			y0 = y0 > p->src_height - 2 ? p->src_height - 2 : y0;
+			//1/16 pixel steps, so the weights multiply out to exactly 256
+			fx = (int)lround((sx - x0) * 16);
+			fy = (int)lround((sy - y0) * 16);
+			tap->offset = (uint32_t)(3 * (y0*p->src_width + x0));
+			tap->w[0] = (uint16_t)((16 - fx) * (16 - fy));
+			tap->w[1] = (uint16_t)(fx * (16 - fy));
+			tap->w[2] = (uint16_t)((16 - fx) * fy);
+			tap->w[3] = (uint16_t)(fx * fy);
+		}
+	}
+	p->valid = 1;
+	return 0;
+}
+
+//reads four "x y" lines (top left, top right, bottom right, bottom left) and applies them
+int projector_load(projector_t * p, const char * path) {
+	FILE * f = fopen(path, "r");
+	float corners[4][2];
+	int i;
+
+	if(f == NULL) {
+		return -1;
+	}
+	for(i=0;i<4;i++) {
+		if(fscanf(f, "%f %f", &corners[i][0], &corners[i][1]) != 2) {
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+	return projector_set_corners(p, corners);
+}
+
+int projector_save(const projector_t * p, const char * path) {
+	FILE * f = fopen(path, "w");
+	int i;
+
+	if(f == NULL) {
+		return -1;
+	}
+	for(i=0;i<4;i++) {
+		fprintf(f, "%f %f\n", p->corners[i][0], p->corners[i][1]);
+	}
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+//one RGB pixel in the low three bytes; the fast form reads (and ignores) the byte after it
+static inline uint32_t load_rgb(const uint8_t * src) {
+	return src[0] | (src[1] << 8) | ((uint32_t)src[2] << 16);
+}
+
+static inline uint32_t load_rgbx(const uint8_t * src) {
+	uint32_t v;
+	memcpy(&v, src, 4);
+	return v;
+}
+
+//warps the src_width x src_height RGB frame src into the width x height RGB frame dst
+void projector_apply(const projector_t * p, const uint8_t * restrict src, uint8_t * restrict dst) {
+	const projector_tap_t * map = p->map;
+	int row = 3 * p->src_width;
+	int count = p->width * p->height;
+	//taps below this offset can be read four bytes at a time without running off the frame
+	uint32_t wide_limit = (uint32_t)(3 * p->src_width * p->src_height - row - 7);
+	int i;
+
+	for(i=0;i<count;i++) {
+		const uint8_t * s = src + map[i].offset;
+		const uint16_t * w = map[i].w;
+		uint32_t a, b, c, d;
+		if(map[i].offset <= wide_limit) {
+			a = load_rgbx(s);
+			b = load_rgbx(s + 3);
+			c = load_rgbx(s + row);
+			d = load_rgbx(s + row + 3);
+		} else {
+			a = load_rgb(s);
+			b = load_rgb(s + 3);
+			c = load_rgb(s + row);
+			d = load_rgb(s + row + 3);
+		}
+#if defined(__SSE2__)
+		//all three channels of two taps per register, weighted in 16 bit lanes
+		__m128i zero = _mm_setzero_si128();
+		__m128i ab = _mm_unpacklo_epi8(_mm_cvtsi32_si128(a), zero);
+		__m128i cd = _mm_unpacklo_epi8(_mm_cvtsi32_si128(c), zero);
+		__m128i weights, sum;
+		uint32_t out;
+		ab = _mm_unpacklo_epi64(ab, _mm_unpacklo_epi8(_mm_cvtsi32_si128(b), zero));
+		cd = _mm_unpacklo_epi64(cd, _mm_unpacklo_epi8(_mm_cvtsi32_si128(d), zero));
+		//w0 w1 w2 w3 -> w0 x4 w1 x4 and w2 x4 w3 x4
+		weights = _mm_loadl_epi64((const __m128i *)w);
+		weights = _mm_unpacklo_epi16(weights, weights);
+		ab = _mm_mullo_epi16(ab, _mm_unpacklo_epi32(weights, weights));
+		cd = _mm_mullo_epi16(cd, _mm_unpackhi_epi32(weights, weights));
+		sum = _mm_add_epi16(ab, cd);
+		sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+		sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+		out = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sum, zero));
+		dst[3*i+0] = (uint8_t)out;
+		dst[3*i+1] = (uint8_t)(out >> 8);
+		dst[3*i+2] = (uint8_t)(out >> 16);
+#else
+		int ch;
+		for(ch=0;ch<3;ch++) {
+			int shift = 8*ch;
+			uint32_t v = ((a >> shift) & 0xff) * w[0] + ((b >> shift) & 0xff) * w[1]
+				+ ((c >> shift) & 0xff) * w[2] + ((d >> shift) & 0xff) * w[3];
+			dst[3*i+ch] = (uint8_t)((v + 128) >> 8);
+		}
+#endif
+	}
+}
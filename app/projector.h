@@ -0,0 +1,63 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/** projector_tap_t
+	Where one projector pixel samples the camera frame: the byte offset of the
+	top left of its 2x2 neighbourhood and the four bilinear weights (summing
+	to 256). Pixels that fall outside the frame have all weights zero.
+**/
+typedef struct {
+	uint32_t offset;
+	uint16_t w[4];
+} projector_tap_t;
+
+/** projector_t
+	Remaps the colourized camera-space frame into projector space.
+	corners: where the projector's top left, top right, bottom right and
+	bottom left corners land in the camera frame, in pixels. The homography
+	between the two is turned into a per-pixel lookup once, so a frame costs
+	one bilinear sample per projector pixel.
+**/
+typedef struct {
+	int src_width;
+	int src_height;
+	int width;
+	int height;
+	int valid;
+	float corners[4][2];
+	double homography[9];	//projector pixel -> camera pixel, row major
+	projector_tap_t * map;
+} projector_t;
+
+int projector_init(projector_t *, int, int, int, int);
+void projector_free(projector_t *);
+int projector_set_corners(projector_t *, float[4][2]);
+int projector_load(projector_t *, const char *);
+int projector_save(const projector_t *, const char *);
+void projector_apply(const projector_t *, const uint8_t *, uint8_t *);
@@ -0,0 +1,422 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "spatial.h"
+
+//builds the pyramid down to a single pixel, returns 0 on success
+int spatial_holes_init(spatial_holes_t * h, int width, int height, uint16_t invalid) {
+	int l;
+	h->invalid = invalid;
+	h->width[0] = width;
+	h->height[0] = height;
+	h->level[0] = NULL;
+	for(l=1;l<SPATIAL_MAX_LEVELS && (h->width[l-1] > 1 || h->height[l-1] > 1);l++) {
+		h->width[l] = (h->width[l-1] + 1) / 2;
+		h->height[l] = (h->height[l-1] + 1) / 2;
+		h->level[l] = (uint16_t *)malloc(h->width[l] * h->height[l] * sizeof(uint16_t));
+		if(h->level[l] == NULL) {
+			h->levels = l;
+			spatial_holes_free(h);
+			return -1;
+		}
+	}
+	h->levels = l;
+	return 0;
+}
+
+void spatial_holes_free(spatial_holes_t * h) {
+	int l;
+	for(l=1;l<h->levels;l++) {
+		free(h->level[l]);
+		h->level[l] = NULL;
+	}
+	h->levels = 0;
+}
+
+//averages the valid pixels of each 2x2 block of src into dst
+//odd edges reuse the last row/column, which only reweights the average
+static void push_level(const uint16_t * restrict src, int sw, int sh, uint16_t * restrict dst, int dw, int dh, uint16_t invalid) {
+	int x, y;
+	for(y=0;y<dh;y++) {
+		const uint16_t * r0 = src + (2*y)*sw;
+		const uint16_t * r1 = src + (2*y+1 < sh ? 2*y+1 : sh-1)*sw;
+		uint16_t * out = dst + y*dw;
+		for(x=0;x<dw;x++) {
+			int x0 = 2*x;
+			int x1 = 2*x+1 < sw ? 2*x+1 : sw-1;
+			uint32_t a = r0[x0], b = r0[x1], c = r1[x0], d = r1[x1];
+			uint32_t va = a != invalid, vb = b != invalid, vc = c != invalid, vd = d != invalid;
+			uint32_t n = va + vb + vc + vd;
+			uint32_t sum = a*va + b*vb + c*vc + d*vd;
+			//divide by 1..4 without a division: 21846/65536 ~ 1/3
+			uint32_t avg = n == 4 ? (sum + 2) >> 2 : (n == 2 ? (sum + 1) >> 1 : (n == 3 ? ((sum * 21846) + 32768) >> 16 : sum));
+			out[x] = n ? (uint16_t)avg : invalid;
+		}
+	}
+}
+
+//replaces holes in dst with the covering pixel of the (already filled) coarser level
+static void pull_level(const uint16_t * src, uint16_t * dst, int dw, int dh, const uint16_t * restrict coarse, int cw, uint16_t invalid) {
+	int x, y;
+	for(y=0;y<dh;y++) {
+		const uint16_t * in = src + y*dw;
+		const uint16_t * up = coarse + (y/2)*cw;
+		uint16_t * out = dst + y*dw;
+		for(x=0;x<dw;x++) {
+			uint16_t v = in[x];
+			out[x] = v != invalid ? v : up[x/2];
+		}
+	}
+}
+
+//fills every invalid pixel of in from the nearest valid surroundings, writing to out
+//in and out may be the same buffer; a frame with no valid pixel at all is passed through
+void spatial_fill_holes(spatial_holes_t * h, const uint16_t * in, uint16_t * out) {
+	int l;
+	const uint16_t * src = in;
+
+	for(l=1;l<h->levels;l++) {
+		push_level(src, h->width[l-1], h->height[l-1], h->level[l], h->width[l], h->height[l], h->invalid);
+		src = h->level[l];
+	}
+	for(l=h->levels-2;l>=1;l--) {
+		pull_level(h->level[l], h->level[l], h->width[l], h->height[l], h->level[l+1], h->width[l+1], h->invalid);
+	}
+	if(h->levels > 1) {
+		pull_level(in, out, h->width[0], h->height[0], h->level[1], h->width[1], h->invalid);
+	} else if(out != in) {
+		for(l=0;l<h->width[0]*h->height[0];l++) {
+			out[l] = in[l];
+		}
+	}
+}
+
+int spatial_smooth_init(spatial_smooth_t * s, int width, int height, uint16_t invalid) {
+	s->width = width;
+	s->height = height;
+	s->invalid = invalid;
+	s->kernel_radius = -1;
+	s->row = (uint16_t *)malloc((width + 2 * SPATIAL_MAX_RADIUS) * sizeof(uint16_t));
+	s->acc = (uint32_t *)malloc(width * sizeof(uint32_t));
+	s->pass = (uint16_t *)malloc(width * height * sizeof(uint16_t));
+	s->splat_x = (int *)malloc(width * sizeof(int));
+	s->cell_x = (int *)malloc(width * sizeof(int));
+	s->frac_x = (float *)malloc(width * sizeof(float));
+	s->splat_z = (int *)malloc(65536 * sizeof(int));
+	s->cell_z = (int *)malloc(65536 * sizeof(int));
+	s->frac_z = (float *)malloc(65536 * sizeof(float));
+	//never reallocated, the depth thread doesn't wait on the allocator
+	s->grid = (float *)malloc((size_t)SPATIAL_GRID_CELLS * 2 * sizeof(float));
+	s->grid_tmp = (float *)malloc((size_t)SPATIAL_GRID_CELLS * 2 * sizeof(float));
+	if(s->row == NULL || s->acc == NULL || s->pass == NULL || s->splat_x == NULL || s->cell_x == NULL || s->frac_x == NULL
+			|| s->splat_z == NULL || s->cell_z == NULL || s->frac_z == NULL || s->grid == NULL || s->grid_tmp == NULL) {
+		spatial_smooth_free(s);
+		return -1;
+	}
+	return 0;
+}
+
+void spatial_smooth_free(spatial_smooth_t * s) {
+	free(s->row);
+	free(s->acc);
+	free(s->pass);
+	free(s->splat_x);
+	free(s->cell_x);
+	free(s->frac_x);
+	free(s->splat_z);
+	free(s->cell_z);
+	free(s->frac_z);
+	free(s->grid);
+	free(s->grid_tmp);
+	s->row = NULL;
+	s->acc = NULL;
+	s->pass = NULL;
+	s->splat_x = NULL;
+	s->cell_x = NULL;
+	s->frac_x = NULL;
+	s->splat_z = NULL;
+	s->cell_z = NULL;
+	s->frac_z = NULL;
+	s->grid = NULL;
+	s->grid_tmp = NULL;
+}
+
+static int clamp_radius(int radius) {
+	return radius < 1 ? 1 : (radius > SPATIAL_MAX_RADIUS ? SPATIAL_MAX_RADIUS : radius);
+}
+
+//gaussian weights with sigma radius/2, rounded so they sum to exactly 256
+static void build_kernel(spatial_smooth_t * s, int radius) {
+	float sigma = radius * 0.5f;
+	float w[2 * SPATIAL_MAX_RADIUS + 1];
+	float total = 0;
+	int sum = 0;
+	int i;
+
+	for(i=-radius;i<=radius;i++) {
+		w[i + radius] = expf(-(i * i) / (2 * sigma * sigma));
+		total += w[i + radius];
+	}
+	for(i=0;i<2*radius+1;i++) {
+		s->kernel[i] = (uint32_t)(w[i] * 256 / total + 0.5f);
+		sum += s->kernel[i];
+	}
+	s->kernel[radius] += 256 - sum;
+	s->kernel_radius = radius;
+}
+
+//acc[x] = sum of kernel[j] * src[x + j], every tap a whole row at a time so it vectorizes
+static void convolve_row(const uint32_t * restrict kernel, int taps, const uint16_t * restrict src,
+		uint32_t * restrict acc, int count) {
+	int i, j;
+	for(i=0;i<count;i++) {
+		acc[i] = 0;
+	}
+	for(j=0;j<taps;j++) {
+		uint32_t k = kernel[j];
+		const uint16_t * in = src + j;
+		for(i=0;i<count;i++) {
+			acc[i] += k * in[i];
+		}
+	}
+}
+
+//separable gaussian blur, edges repeat the outermost pixels; in and out may be the same buffer
+void spatial_gaussian(spatial_smooth_t * s, int radius, const uint16_t * in, uint16_t * out) {
+	int width = s->width;
+	int height = s->height;
+	int taps;
+	int x, y, j;
+
+	radius = clamp_radius(radius);
+	if(radius != s->kernel_radius) {
+		build_kernel(s, radius);
+	}
+	taps = 2 * radius + 1;
+
+	//horizontal, from a padded copy of each row into pass with 4 bits kept below the depth
+	for(y=0;y<height;y++) {
+		const uint16_t * src = in + y * width;
+		uint16_t * dst = s->pass + y * width;
+		for(x=0;x<radius;x++) {
+			s->row[x] = src[0];
+			s->row[radius + width + x] = src[width - 1];
+		}
+		for(x=0;x<width;x++) {
+			s->row[radius + x] = src[x];
+		}
+		convolve_row(s->kernel, taps, s->row, s->acc, width);
+		for(x=0;x<width;x++) {
+			dst[x] = (uint16_t)((s->acc[x] + 8) >> 4);
+		}
+	}
+
+	//vertical, rows clamped at the top and bottom
+	for(y=0;y<height;y++) {
+		uint16_t * dst = out + y * width;
+		uint32_t * restrict acc = s->acc;
+		for(x=0;x<width;x++) {
+			acc[x] = 0;
+		}
+		for(j=0;j<taps;j++) {
+			int r = y + j - radius;
+			const uint16_t * restrict src;
+			uint32_t k = s->kernel[j];
+			r = r < 0 ? 0 : (r >= height ? height - 1 : r);
+			src = s->pass + r * width;
+			for(x=0;x<width;x++) {
+				acc[x] += k * src[x];
+			}
+		}
+		for(x=0;x<width;x++) {
+			dst[x] = (uint16_t)((acc[x] + 2048) >> 12);
+		}
+	}
+}
+
+//one [1 2 1] / 4 pass along the grid axis whose cells are stride floats apart
+//the grid is padded with empty cells all round, so running the pass over the whole
+//grid as one flat array only ever mixes a cell with its own neighbours or with padding
+static void blur_grid(const float * restrict src, float * restrict dst, int count, int stride) {
+	int i;
+	for(i=0;i<stride;i++) {
+		dst[i] = 0;
+		dst[count - 1 - i] = 0;
+	}
+	for(i=stride;i<count-stride;i++) {
+		dst[i] = 0.25f * src[i - stride] + 0.5f * src[i] + 0.25f * src[i + stride];
+	}
+}
+
+//edge preserving blur through a bilateral grid: splat, blur the grid, slice trilinearly
+//radius is the cell size in pixels, range the bin size in depth units; in and out may be the same buffer
+void spatial_bilateral(spatial_smooth_t * s, int radius, int range, const uint16_t * in, uint16_t * out) {
+	int width = s->width;
+	int height = s->height;
+	int count = width * height;
+	uint16_t invalid = s->invalid;
+	int lo = 65535, hi = 0;
+	int gw, gh, gd, bins, cells;
+	int sx, sy;		//strides in floats, depth bins are a (sum, weight) pair apart
+	float inv_cell, inv_range;
+	float * g;
+	int x, y, i;
+
+	radius = clamp_radius(radius);
+	range = range < 1 ? 1 : range;
+	for(i=0;i<count;i++) {
+		int d = in[i];
+		int v = d != invalid;
+		int dlo = v ? d : 65535;
+		int dhi = v ? d : 0;
+		lo = dlo < lo ? dlo : lo;
+		hi = dhi > hi ? dhi : hi;
+	}
+	if(lo > hi) {
+		if(out != in) {
+			for(i=0;i<count;i++) {
+				out[i] = in[i];
+			}
+		}
+		return;
+	}
+
+	//an empty cell on each side; pixels round to the nearest cell, which can reach one past the last
+	gw = width / radius + 3;
+	gh = height / radius + 3;
+	while(gw * gh * SPATIAL_GRID_MIN_BINS > SPATIAL_GRID_CELLS && radius < width) {
+		radius++;
+		gw = width / radius + 3;
+		gh = height / radius + 3;
+	}
+	bins = SPATIAL_GRID_CELLS / (gw * gh);
+	if((hi - lo) / range + 4 > bins) {
+		range = (hi - lo) / (bins - 4) + 1;
+	}
+	gd = (hi - lo) / range + 4;
+	cells = gw * gh * gd;
+	g = s->grid;
+	for(i=0;i<cells*2;i++) {
+		g[i] = 0;
+	}
+	sx = gd * 2;
+	sy = gw * sx;
+	inv_cell = 1.0f / radius;
+	inv_range = 1.0f / range;
+	for(x=0;x<width;x++) {
+		float fx = x * inv_cell + 1;
+		s->splat_x[x] = ((x + radius / 2) / radius + 1) * sx;
+		s->cell_x[x] = (int)fx * sx;
+		s->frac_x[x] = fx - (int)fx;
+	}
+	//bins by depth, once for every depth in the frame rather than at every pixel
+	for(i=0;i<=hi-lo;i++) {
+		s->splat_z[i] = ((i + range / 2) / range + 1) * 2;
+		s->cell_z[i] = (i / range + 1) * 2;
+		s->frac_z[i] = (i % range) * inv_range;
+	}
+
+	//splat every valid pixel into its nearest cell
+	for(y=0;y<height;y++) {
+		const uint16_t * src = in + y * width;
+		float * row = g + ((y + radius / 2) / radius + 1) * sy;
+		for(x=0;x<width;x++) {
+			int d = src[x];
+			float * cell;
+			if(d == invalid) {
+				continue;
+			}
+			cell = row + s->splat_x[x] + s->splat_z[d - lo];
+			cell[0] += d;
+			cell[1] += 1;
+		}
+	}
+
+	//blur along depth, then x, then y, ping-ponging between the two grids
+	blur_grid(s->grid, s->grid_tmp, cells * 2, 2);
+	blur_grid(s->grid_tmp, s->grid, cells * 2, sx);
+	blur_grid(s->grid, s->grid_tmp, cells * 2, sy);
+	g = s->grid_tmp;
+
+	//slice: trilinear lookup at every pixel's position and depth
+	for(y=0;y<height;y++) {
+		const uint16_t * src = in + y * width;
+		uint16_t * dst = out + y * width;
+		float fy = y * inv_cell + 1;
+		const float * row = g + (int)fy * sy;
+		float ty = fy - (int)fy;
+		for(x=0;x<width;x++) {
+			int d = src[x];
+			float tx, tz, sum, weight;
+			const float * c;
+			if(d == invalid) {
+				dst[x] = invalid;
+				continue;
+			}
+			tz = s->frac_z[d - lo];
+			tx = s->frac_x[x];
+			c = row + s->cell_x[x] + s->cell_z[d - lo];
+#if defined(__SSE2__)
+			{
+				//each corner's two depth bins are four neighbouring floats: sum, weight, sum, weight
+				__m128 wx = _mm_set1_ps(tx);
+				__m128 wy = _mm_set1_ps(ty);
+				__m128 c00 = _mm_loadu_ps(c);
+				__m128 c01 = _mm_loadu_ps(c + sx);
+				__m128 c10 = _mm_loadu_ps(c + sy);
+				__m128 c11 = _mm_loadu_ps(c + sy + sx);
+				__m128 top = _mm_add_ps(c00, _mm_mul_ps(wx, _mm_sub_ps(c01, c00)));
+				__m128 bottom = _mm_add_ps(c10, _mm_mul_ps(wx, _mm_sub_ps(c11, c10)));
+				__m128 v = _mm_add_ps(top, _mm_mul_ps(wy, _mm_sub_ps(bottom, top)));
+				__m128 far = _mm_movehl_ps(v, v);
+				__m128 r = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(tz), _mm_sub_ps(far, v)));
+				sum = _mm_cvtss_f32(r);
+				weight = _mm_cvtss_f32(_mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 1, 1, 1)));
+			}
+#else
+			{
+				float v[4];
+				int k;
+				for(k=0;k<4;k++) {
+					float top = c[k] + tx * (c[sx + k] - c[k]);
+					float bottom = c[sy + k] + tx * (c[sy + sx + k] - c[sy + k]);
+					v[k] = top + ty * (bottom - top);
+				}
+				sum = v[0] + tz * (v[2] - v[0]);
+				weight = v[1] + tz * (v[3] - v[1]);
+			}
+#endif
+			dst[x] = weight > 1e-6f ? (uint16_t)(sum / weight + 0.5f) : (uint16_t)d;
+		}
+	}
+}
@@ -0,0 +1,91 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define SPATIAL_MAX_LEVELS 12
+
+/** spatial_holes_t
+	Push-pull pyramid for filling pixels without a depth reading.
+	Each coarser level averages the valid pixels below it, then holes are
+	filled top down from the level above. All levels are allocated up front.
+	invalid: the depth value that marks "no reading" (2047 for raw 11 bit depth)
+**/
+typedef struct {
+	int levels;
+	int width[SPATIAL_MAX_LEVELS];
+	int height[SPATIAL_MAX_LEVELS];
+	uint16_t * level[SPATIAL_MAX_LEVELS];	//level[0] is never allocated, it is the input frame
+	uint16_t invalid;
+} spatial_holes_t;
+
+int spatial_holes_init(spatial_holes_t *, int, int, uint16_t);
+void spatial_holes_free(spatial_holes_t *);
+void spatial_fill_holes(spatial_holes_t *, const uint16_t *, uint16_t *);
+
+#define SPATIAL_MAX_RADIUS 8
+#define SPATIAL_GRID_CELLS (1 << 18)	//bilateral grid cells, allocated up front
+#define SPATIAL_GRID_MIN_BINS 6		//depth bins a grid keeps, padding included
+
+#define SPATIAL_SMOOTH_OFF 0
+#define SPATIAL_SMOOTH_GAUSSIAN 1
+#define SPATIAL_SMOOTH_BILATERAL 2
+
+/** spatial_smooth_t
+	Scratch for smoothing depth frames within a frame, no history is kept.
+	Gaussian: separable 2*radius+1 tap kernel with sigma radius/2, in fixed point,
+	meant for frames that have been through spatial_fill_holes first.
+	Bilateral: a bilateral grid with radius pixel cells and range depth units
+	per bin, spanning only the depths present in the frame. Invalid pixels are
+	left out of it and stay invalid. The grid is held to SPATIAL_GRID_CELLS:
+	a frame deeper than its bins can hold at range gets wider bins, and cells
+	too small to leave SPATIAL_GRID_MIN_BINS grow.
+	kernel_radius: the radius kernel was built for
+**/
+typedef struct {
+	int width;
+	int height;
+	uint16_t invalid;
+	int kernel_radius;
+	uint32_t kernel[2 * SPATIAL_MAX_RADIUS + 1];	//sums to 256
+	uint16_t * row;		//one row padded by SPATIAL_MAX_RADIUS on either side
+	uint32_t * acc;		//one row of sums
+	uint16_t * pass;	//the horizontal pass, depth in 12.4 fixed point
+	float * grid;		//bilateral cells, a (sum, weight) pair each
+	float * grid_tmp;
+	int * splat_x;		//per column, offset of the nearest grid cell
+	int * cell_x;		//per column, offset of the grid cell to the left and the weight of the one to the right
+	float * frac_x;
+	int * splat_z;		//the same per depth above the frame's lowest, for every 16 bit depth
+	int * cell_z;
+	float * frac_z;
+} spatial_smooth_t;
+
+int spatial_smooth_init(spatial_smooth_t *, int, int, uint16_t);
+void spatial_smooth_free(spatial_smooth_t *);
+void spatial_gaussian(spatial_smooth_t *, int, const uint16_t *, uint16_t *);
+void spatial_bilateral(spatial_smooth_t *, int, int, const uint16_t *, uint16_t *);
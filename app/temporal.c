@@ -0,0 +1,196 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "temporal.h"
+
+#define EMA_FRAC_BITS 4
+#define EMA_INVALID (TEMPORAL_INVALID_DEPTH << EMA_FRAC_BITS)
+
+//allocates state for count pixels, every pixel starts out without a reading
+int temporal_ema_init(temporal_ema_t * f, int count, float alpha, int motion_threshold, int hold_frames) {
+	int i;
+	f->count = count;
+	f->alpha = alpha;
+	f->motion_threshold = motion_threshold;
+	f->hold_frames = hold_frames;
+	f->state = (uint16_t *)malloc(count * sizeof(uint16_t));
+	f->missed = (uint8_t *)calloc(count, 1);
+	if(f->state == NULL || f->missed == NULL) {
+		temporal_ema_free(f);
+		return -1;
+	}
+	for(i=0;i<count;i++) {
+		f->state[i] = EMA_INVALID;
+	}
+	return 0;
+}
+
+void temporal_ema_free(temporal_ema_t * f) {
+	free(f->state);
+	free(f->missed);
+	f->state = NULL;
+	f->missed = NULL;
+}
+
+//folds one raw depth frame into the average and writes the smoothed frame to out
+//the loop is branch free so the compiler can vectorize it, every choice is a select
+void temporal_ema_apply(temporal_ema_t * f, const uint16_t * restrict in, uint16_t * restrict out) {
+	//alpha and thresholds are read once per frame so they can be changed between frames
+	int32_t a = (int32_t)(f->alpha * 256.0f + 0.5f);
+	int32_t thresh = f->motion_threshold << EMA_FRAC_BITS;
+	int32_t hold = f->hold_frames < 255 ? f->hold_frames : 255;
+	uint16_t * restrict state = f->state;
+	uint8_t * restrict missed = f->missed;
+	int count = f->count;
+	int i;
+
+	a = a < 0 ? 0 : (a > 256 ? 256 : a);
+	for(i=0;i<count;i++) {
+		int32_t x = in[i];
+		int32_t s = state[i];
+		int32_t m = missed[i];
+		int32_t x4 = x << EMA_FRAC_BITS;
+		int32_t diff = x4 - s;
+		int32_t adiff = diff < 0 ? -diff : diff;
+		int32_t valid_in = x < TEMPORAL_INVALID_DEPTH;
+		//no history, or the surface moved: start over from this reading
+		int32_t snap = (s == EMA_INVALID) | (adiff > thresh);
+		int32_t ema = s + ((diff * a + 128) >> 8);
+		int32_t updated = snap ? x4 : ema;
+		int32_t held;
+
+		m = valid_in ? 0 : (m < 255 ? m + 1 : 255);
+		held = m > hold ? EMA_INVALID : s;
+		s = valid_in ? updated : held;
+
+		state[i] = (uint16_t)s;
+		missed[i] = (uint8_t)m;
+		out[i] = (uint16_t)((s + (1 << (EMA_FRAC_BITS - 1))) >> EMA_FRAC_BITS);
+	}
+}
+
+//allocates the frame ring, every slot starts out without a reading
+int temporal_median_init(temporal_median_t * f, int count, int frames) {
+	int i;
+	f->count = count;
+	f->frames = frames;
+	f->next = 0;
+	f->ring = NULL;
+	if(frames != 3 && frames != 5 && frames != 7) {
+		return -1;
+	}
+	f->ring = (uint16_t *)malloc((size_t)count * frames * sizeof(uint16_t));
+	if(f->ring == NULL) {
+		return -1;
+	}
+	for(i=0;i<count*frames;i++) {
+		f->ring[i] = TEMPORAL_INVALID_DEPTH;
+	}
+	return 0;
+}
+
+void temporal_median_free(temporal_median_t * f) {
+	free(f->ring);
+	f->ring = NULL;
+}
+
+//sorting network compare-exchange, min and max only so whole rows vectorize
+#define SORT2(a,b) { uint16_t lo = v##a < v##b ? v##a : v##b; \
+	v##b = v##a < v##b ? v##b : v##a; v##a = lo; }
+
+//no reading is 2047, above every real depth, so after sorting a pixel's valid
+//samples come first and its median is the middle of those: sorted[(valid-1)/2]
+//with no valid samples that is sorted[0], which is then 2047 as well
+#define VALID(x) ((x) < TEMPORAL_INVALID_DEPTH)
+
+static void median3(const uint16_t * restrict r0, const uint16_t * restrict r1,
+		const uint16_t * restrict r2, uint16_t * restrict out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		uint16_t v0 = r0[i], v1 = r1[i], v2 = r2[i];
+		int k = VALID(v0) + VALID(v1) + VALID(v2);
+		SORT2(0,1) SORT2(1,2) SORT2(0,1)
+		out[i] = k >= 3 ? v1 : v0;
+	}
+}
+
+static void median5(const uint16_t * restrict r0, const uint16_t * restrict r1,
+		const uint16_t * restrict r2, const uint16_t * restrict r3,
+		const uint16_t * restrict r4, uint16_t * restrict out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		uint16_t v0 = r0[i], v1 = r1[i], v2 = r2[i], v3 = r3[i], v4 = r4[i];
+		int k = VALID(v0) + VALID(v1) + VALID(v2) + VALID(v3) + VALID(v4);
+		uint16_t m;
+		SORT2(0,1) SORT2(3,4) SORT2(2,4) SORT2(2,3) SORT2(0,3)
+		SORT2(0,2) SORT2(1,4) SORT2(1,3) SORT2(1,2)
+		m = k >= 3 ? v1 : v0;
+		out[i] = k >= 5 ? v2 : m;
+	}
+}
+
+static void median7(const uint16_t * restrict r0, const uint16_t * restrict r1,
+		const uint16_t * restrict r2, const uint16_t * restrict r3,
+		const uint16_t * restrict r4, const uint16_t * restrict r5,
+		const uint16_t * restrict r6, uint16_t * restrict out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		uint16_t v0 = r0[i], v1 = r1[i], v2 = r2[i], v3 = r3[i], v4 = r4[i], v5 = r5[i], v6 = r6[i];
+		int k = VALID(v0) + VALID(v1) + VALID(v2) + VALID(v3) + VALID(v4) + VALID(v5) + VALID(v6);
+		uint16_t m;
+		SORT2(0,6) SORT2(2,3) SORT2(4,5) SORT2(0,2) SORT2(1,4) SORT2(3,6)
+		SORT2(0,1) SORT2(2,5) SORT2(3,4) SORT2(1,2) SORT2(4,6) SORT2(2,3)
+		SORT2(4,5) SORT2(1,2) SORT2(3,4) SORT2(5,6)
+		m = k >= 3 ? v1 : v0;
+		m = k >= 5 ? v2 : m;
+		out[i] = k >= 7 ? v3 : m;
+	}
+}
+
+//replaces the oldest frame in the ring with in and writes the per pixel median to out
+void temporal_median_apply(temporal_median_t * f, const uint16_t * in, uint16_t * out) {
+	int count = f->count;
+	uint16_t * r = f->ring;
+
+	memcpy(r + (size_t)f->next * count, in, count * sizeof(uint16_t));
+	f->next = (f->next + 1) % f->frames;
+	//the median does not care about frame order, the planes go in as they lie
+	switch(f->frames) {
+	case 3:
+		median3(r, r + count, r + 2*count, out, count);
+		break;
+	case 5:
+		median5(r, r + count, r + 2*count, r + 3*count, r + 4*count, out, count);
+		break;
+	case 7:
+		median7(r, r + count, r + 2*count, r + 3*count, r + 4*count,
+			r + 5*count, r + 6*count, out, count);
+		break;
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define TEMPORAL_INVALID_DEPTH 2047
+
+/** temporal_ema_t
+	Per pixel exponential moving average over raw 11 bit depth frames.
+	alpha: weight of the newest frame, 1.0 disables smoothing
+	motion_threshold: raw depth step beyond which a pixel snaps to the new reading
+	hold_frames: frames a pixel keeps its last height while the camera reports no reading
+	state is kept in 12.4 fixed point so small alphas still converge
+**/
+typedef struct {
+	int count;
+	float alpha;
+	int motion_threshold;
+	int hold_frames;
+	uint16_t * state;
+	uint8_t * missed;
+} temporal_ema_t;
+
+int temporal_ema_init(temporal_ema_t *, int, float, int, int);
+void temporal_ema_free(temporal_ema_t *);
+void temporal_ema_apply(temporal_ema_t *, const uint16_t *, uint16_t *);
+
+/** temporal_median_t
+	Per pixel median over the last frames raw 11 bit depth frames, 3, 5 or 7 of them.
+	Unlike the average it drops a hand passing over the sand outright instead of
+	smearing it, at the cost of frames/2 frames of lag.
+	Pixels without a reading are left out, the median is over the readings a pixel
+	does have and a pixel only loses its depth once none of the frames have one.
+	ring holds frames planes of count pixels, next is the plane the next frame replaces
+**/
+typedef struct {
+	int count;
+	int frames;
+	int next;
+	uint16_t * ring;
+} temporal_median_t;
+
+int temporal_median_init(temporal_median_t *, int, int);
+void temporal_median_free(temporal_median_t *);
+void temporal_median_apply(temporal_median_t *, const uint16_t *, uint16_t *);
@@ -0,0 +1,184 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "tiles.h"
+
+//width x height frames in size pixel tiles, the edge tiles take what is left over
+//returns -1 if the buffers can't be allocated
+int tiles_init(tiles_t * t, int width, int height, int size, int threshold) {
+	t->width = width;
+	t->height = height;
+	t->size = size;
+	t->cols = (width + size - 1) / size;
+	t->rows = (height + size - 1) / size;
+	t->count = t->cols * t->rows;
+	t->threshold = threshold;
+	t->frame = 0;
+	t->force = 1;
+	t->reference = (uint16_t *)malloc(width * height * sizeof(uint16_t));
+	t->changed = (uint32_t *)calloc(t->count, sizeof(uint32_t));
+	if(t->reference == NULL || t->changed == NULL) {
+		tiles_free(t);
+		return -1;
+	}
+	return 0;
+}
+
+void tiles_free(tiles_t * t) {
+	free(t->reference);
+	free(t->changed);
+	t->reference = NULL;
+	t->changed = NULL;
+}
+
+//has any pixel of the run moved more than threshold from the reference
+static int run_moved(const uint16_t * depth, const uint16_t * ref, int n, int threshold) {
+	int i = 0;
+#if defined(__SSE2__)
+	__m128i limit = _mm_set1_epi16((short)threshold);
+	for(;i+8<=n;i+=8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(depth + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(ref + i));
+		//|a - b| from two saturating subtractions, then whatever is left above the limit
+		__m128i diff = _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+		__m128i over = _mm_subs_epu16(diff, limit);
+		if(_mm_movemask_epi8(_mm_cmpeq_epi16(over, _mm_setzero_si128())) != 0xFFFF) {
+			return 1;
+		}
+	}
+#endif
+	for(;i<n;i++) {
+		int d = depth[i] - ref[i];
+		if(d > threshold || d < -threshold) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//compares depth with the reference tile by tile, returns how many tiles changed
+//pixels losing or gaining a reading (2047) step far past any threshold, so they count too
+int tiles_update(tiles_t * t, const uint16_t * depth) {
+	int changes = 0;
+	int tx, ty, y;
+
+	t->frame++;
+	for(ty=0;ty<t->rows;ty++) {
+		int y0 = ty * t->size;
+		int y1 = y0 + t->size < t->height ? y0 + t->size : t->height;
+		for(tx=0;tx<t->cols;tx++) {
+			int x0 = tx * t->size;
+			int w = x0 + t->size < t->width ? t->size : t->width - x0;
+			int moved = t->force;
+			for(y=y0;y<y1 && !moved;y++) {
+				moved = run_moved(depth + y * t->width + x0, t->reference + y * t->width + x0, w, t->threshold);
+			}
+			if(moved) {
+				for(y=y0;y<y1;y++) {
+					memcpy(t->reference + y * t->width + x0, depth + y * t->width + x0, w * sizeof(uint16_t));
+				}
+				t->changed[ty * t->cols + tx] = t->frame;
+				changes++;
+			}
+		}
+	}
+	t->force = 0;
+	return changes;
+}
+
+//the next update treats every tile as changed, for when what the depth maps to has changed
+void tiles_invalidate(tiles_t * t) {
+	t->force = 1;
+}
+
+//stamps for one copy of the output, all stale to begin with, NULL if out of memory
+uint32_t * tiles_alloc_stamps(const tiles_t * t) {
+	uint32_t * stamps = (uint32_t *)malloc(t->count * sizeof(uint32_t));
+	int i;
+
+	if(stamps != NULL) {
+		for(i=0;i<t->count;i++) {
+			stamps[i] = TILES_STALE;
+		}
+	}
+	return stamps;
+}
+
+//marks a copy of the output as brought up to date with the last update
+void tiles_stamp(const tiles_t * t, uint32_t * stamps) {
+	memcpy(stamps, t->changed, t->count * sizeof(uint32_t));
+}
+
+//finds the first tile from *tile on where stamps differ from want (usually t->changed),
+//and how many such tiles follow it in the same tile row
+//returns 0 once there are none left, callers step *tile on by *run between calls
+//only reads the tile layout from t, so it is safe on another thread with its own want
+int tiles_next_stale(const tiles_t * t, const uint32_t * stamps, const uint32_t * want, int * tile, int * run) {
+	int i = *tile;
+	int end;
+
+	while(i < t->count && stamps[i] == want[i]) {
+		i++;
+	}
+	if(i >= t->count) {
+		return 0;
+	}
+	end = i + 1;
+	while(end % t->cols != 0 && stamps[end] != want[end]) {
+		end++;
+	}
+	*tile = i;
+	*run = end - i;
+	return 1;
+}
+
+//does the tile row have any tile where stamps differ from want
+int tiles_row_stale(const tiles_t * t, const uint32_t * stamps, const uint32_t * want, int row) {
+	int i;
+	for(i=row*t->cols;i<(row+1)*t->cols;i++) {
+		if(stamps[i] != want[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//pixel rectangle covered by run tiles starting at tile
+void tiles_rect(const tiles_t * t, int tile, int run, int * x, int * y, int * w, int * h) {
+	int tx = tile % t->cols;
+	int ty = tile / t->cols;
+	*x = tx * t->size;
+	*y = ty * t->size;
+	*w = (tx + run) * t->size < t->width ? run * t->size : t->width - *x;
+	*h = *y + t->size < t->height ? t->size : t->height - *y;
+}
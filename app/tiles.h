@@ -0,0 +1,67 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define TILES_SIZE 32
+#define TILES_THRESHOLD 2		//raw depth, about the jitter left after smoothing
+#define TILES_STALE UINT32_MAX	//stamp that no tile ever has
+
+/** tiles_t
+	Change tracking over a depth frame cut into size x size tiles.
+	A tile changes once one of its pixels moves more than threshold from the
+	reference, the frame it last changed in; jitter under the threshold never
+	builds up, while a slow drift past it still shows.
+	changed[t] is the update that last changed tile t. Each copy of the output
+	(a frame buffer, a texture) keeps its own stamps, the changed[] it was last
+	brought up to date with, and only its tiles whose stamp differs need redoing.
+	A copy made from another compares its stamps with that one's instead.
+**/
+typedef struct {
+	int width;
+	int height;
+	int size;
+	int cols;
+	int rows;
+	int count;
+	int threshold;
+	uint32_t frame;
+	int force;
+	uint16_t * reference;
+	uint32_t * changed;
+} tiles_t;
+
+int tiles_init(tiles_t *, int, int, int, int);
+void tiles_free(tiles_t *);
+int tiles_update(tiles_t *, const uint16_t *);
+void tiles_invalidate(tiles_t *);
+uint32_t * tiles_alloc_stamps(const tiles_t *);
+void tiles_stamp(const tiles_t *, uint32_t *);
+int tiles_next_stale(const tiles_t *, const uint32_t *, const uint32_t *, int *, int *);
+int tiles_row_stale(const tiles_t *, const uint32_t *, const uint32_t *, int);
+void tiles_rect(const tiles_t *, int, int, int *, int *, int *, int *);
@@ -36,31 +36,163 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 #include "libfreenect.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
+
+#include "triplebuf.h"
+#include "tiles.h"
+#include "occlusion.h"
+#include "water.h"
+#include "hillshade.h"
+#include "colourmap.h"
+#include "temporal.h"
+#include "spatial.h"
+#include "baseplane.h"
+#include "workers.h"
+#include "dem.h"
+#include "headless.h"
+#include "projector.h"
 
 #if defined(__APPLE__)
 #include <GLUT/glut.h>
+#include <OpenGL/OpenGL.h>
 #else
+#define GL_GLEXT_PROTOTYPES
 #include <GL/glut.h>
+#include <GL/glext.h>
+#if defined(__linux__)
+#include <GL/glx.h>
+#endif
 #endif
 
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+#define COLOUR_INIT_PATH "colour.init"
+#define GAMMA_SPAN (6*256)
+
+//temporal smoothing of the raw depth, see temporal.h
+#define SMOOTH_ALPHA 0.5f
+#define SMOOTH_MOTION_THRESHOLD 40
+#define SMOOTH_HOLD_FRAMES 3
+//frames in the median, which replaces the average unless toggled off with 's'
+#define SMOOTH_MEDIAN_FRAMES 5
+
+//once calibrated, the palette spans these heights above the sandbox floor
+#define HEIGHT_TOP_MM 250
+#define HEIGHT_BOTTOM_MM -50
+
+//a pixel's width in raw depth steps near a metre out, negative as raw depth grows away from the light
+#define RELIEF_RAW_CELL -0.5f
+
+//top down map raster, 0 fits the cell size to the camera's view of the floor
+#define DEM_CELL_MM 0
+
+//redraws happen only for new frames, at most once per display refresh
+#define PACER_REFRESH_HZ 60
+#define PACER_POLL_MS 2
+
+//camera -> projector corner calibration, reloaded at startup
+#define PROJECTOR_CAL_PATH "projector.cal"
+
 pthread_t freenect_thread;
 volatile int die = 0;
 int window;
 
-pthread_mutex_t gl_backbuf_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-// back: owned by libfreenect (implicit for depth)
-// mid: owned by callbacks, "latest frame ready"
+// colourized depth frames, handed from depth_cb to DrawGLScene without locking
+// back: owned by depth_cb, being colourized
+// mid: shared, "latest frame ready"
 // front: owned by GL, "currently being drawn"
-uint8_t *depth_mid, *depth_front;
-uint8_t *last_frame_clone; //a dump to store the frame currently being pushed
-						  //used to obtain a more stable output by comparing the two buffers
+triplebuf_t depth_frames;
+uint8_t *depth_front;
+
+// raw depth smoothed over time and with holes filled, only touched by depth_cb
+temporal_ema_t depth_smoothing;
+temporal_median_t depth_median;
+volatile int use_median = 1;
+spatial_holes_t depth_holes;
+uint16_t *depth_smoothed;
+
+// the empty sandbox floor, heights are measured from it once it has been fitted
+baseplane_t base_plane;
+int16_t *depth_height;
+volatile int calibrate_requested = 0;
+
+// the camera's view is only coloured and uploaded again where the sand moved, see tiles.h
+#define COLOUR_PATH_MAP 0
+#define COLOUR_PATH_HEIGHT 1
+#define COLOUR_PATH_RAW 2
+tiles_t depth_tiles;
+uint32_t *frame_stamps[3]; //what each of depth_frames' buffers was last coloured from
+uint32_t *texture_stamps; //what the texture was last uploaded from, GL thread only
+int colour_path = -1;
+int colour_warped = 0;
+
+// slopes lit from the top left over the palette's colours, see hillshade.h
+// heights are shaded with the map's cell size once calibrated, raw depth with RELIEF_RAW_CELL
+hillshade_t raw_relief;
+hillshade_t height_relief;
+volatile int shade_relief = 1;
+int colour_shaded = -1;
+
+// hands and arms reaching in are replaced by the sand under them, see occlusion.h
+occlusion_t occluders;
+uint16_t *depth_clean;
+volatile int reject_hands = 1;
+int hands_rejected = 0;
+volatile int show_occluders = 0; //paints the rejected pixels over the camera's view
+int colour_masked = 0;
+
+// top down elevation map over the base plane, drawn instead of the camera's view once calibrated
+workers_t frame_workers;
+dem_t dem;
+int dem_ready = 0;
+volatile int map_view = 1;
+
+// shallow water over the sand, stepped on its own thread at WATER_HZ whatever the camera does, see water.h
+// depth_cb hands it terrain and blends in the water layers it hands back
+water_t water;
+workers_t water_workers;
+pthread_t water_thread;
+int water_started = 0;
+triplebuf_t water_terrain;
+triplebuf_t water_layers;
+float raw_terrain[2048]; //raw depth -> height, until a calibration brings heights
+float map_terrain[2048]; //DEM slot -> height
+volatile int raining = 0;
+volatile int water_clear_requested = 0;
+int water_path = -1;
+int water_shown = 0;
+
+// running without a window, see headless.h
+headless_options_t headless;
+headless_sink_t frame_sink;
+headless_timing_t depth_timing;
+int stage_hands, stage_smooth, stage_map, stage_colour, stage_water, stage_warp;
+
+// warp into projector space, the projector's lookup is only touched by depth_cb
+projector_t projector;
+uint8_t *colour_scratch; //camera space frame while warping
+volatile int warp_enabled = 0;
+atomic_int projector_update_requested = 0;
+float picked_corners[4][2]; //clicked on the GL thread, released to depth_cb by projector_update_requested
+int picking = 0; //corners still to click
+int window_width = 640;
+int window_height = 480;
+
+// when each buffer's frame reached depth_cb, indexed like depth_frames.buffers
+double depth_frame_ms[3];
+// frame pacing and the on-screen counter, GL thread only
+double last_draw_ms = 0;
+int show_stats = 1;
+unsigned stats_frames = 0;
+double stats_latency_ms = 0;
+double stats_window_start = 0;
+float shown_fps = 0;
+float shown_latency_ms = 0;
 
 //uint8_t *rgb_back, *rgb_mid, *rgb_front;
 
@@ -68,6 +200,9 @@ int g_argc;
 char **g_argv;
 
 GLuint gl_depth_tex;
+GLuint gl_depth_pbo[2]; //streaming uploads alternate between these
+int gl_pbo_next = 0;
+int use_pbo = 0;
 //GLuint gl_rgb_tex;
 GLfloat camera_angle = 0.0;
 int camera_rotate = 0;
@@ -82,40 +217,193 @@ freenect_video_format requested_format = FREENECT_VIDEO_RGB;
 freenect_video_format current_format = FREENECT_VIDEO_RGB;
 
 uint16_t t_gamma[2048];
-
-pthread_cond_t gl_frame_cond = PTHREAD_COND_INITIALIZER;
-int got_depth = 0;
+colour_palette_t palette;
+colourmap_t depth_colours; //t_gamma and palette folded together, rebuild whenever either changes
+colour_lut_t height_colours; //heights in mm, HEIGHT_TOP_MM down to HEIGHT_BOTTOM_MM
+colour_lut_t map_colours; //the same for the map's raster, height + COLOURMAP_HEIGHT_ZERO with 2047 for none
+volatile int palette_reload_requested = 0;
 
 //function headers
 void depth_cb(freenect_device *, void *, uint32_t);
 void *gl_threadfunc(void *); 
 void *freenect_threadfunc(void *);
+void *synthetic_threadfunc(void *);
+void *water_threadfunc(void *);
+int init_kinect(int, char **);
+void run_headless();
+void release_buffers();
+void build_height_colours();
 void ReSizeGLScene(int, int);
+void frame_pacer(int);
+void enable_vsync();
+void upload_depth_texture(uint8_t *, const uint32_t *);
+void draw_stats();
+void mouse_pressed(int, int, int, int);
 void InitGL(int, int);
 void DrawGLScene();
-void render_contour(uint8_t *);
 
 void keyPressed(unsigned char key, int x, int y) {
 	if (key == 27) {
 		die = 1;
 		pthread_join(freenect_thread, NULL);
 		glutDestroyWindow(window);
-		free(depth_mid);
-		free(depth_front);
+		release_buffers();
 		// Not pthread_exit because OSX leaves a thread lying around and doesn't exit
 		exit(0);
 	}
+	if (key == 'c') {
+		//fit the floor on the next frame, the sandbox should be empty
+		calibrate_requested = 1;
+	}
+	if (key == 'l') {
+		//colour.init is read again and the tables rebuilt before the next frame is coloured
+		palette_reload_requested = 1;
+	}
+	if (key == 'h') {
+		reject_hands = !reject_hands;
+		printf("Hand rejection %s\n", reject_hands ? "on" : "off");
+	}
+	if (key == 'o') {
+		show_occluders = !show_occluders;
+	}
+	if (key == 'r') {
+		raining = !raining;
+		printf("Rain %s\n", raining ? "on" : "off");
+	}
+	if (key == 'x') {
+		water_clear_requested = 1;
+	}
+	if (key == 'e') {
+		shade_relief = !shade_relief;
+	}
+	if (key == 'm') {
+		//toggle between the top down map and the camera's view
+		map_view = !map_view;
+	}
+	if (key == 'f') {
+		show_stats = !show_stats;
+		glutPostRedisplay();
+	}
+	if (key == 's') {
+		//the filter not in use keeps its old frames, it catches up within a few
+		use_median = !use_median;
+		printf("Smoothing with the %s\n", use_median ? "median" : "average");
+	}
+	if (key == 'p') {
+		//click where the projector's corners land, starting top left and going clockwise
+		printf("Click the projected image's top left, top right, bottom right and bottom left corners\n");
+		warp_enabled = 0;
+		picking = 4;
+	}
+	if (key == 'w' && !picking) {
+		warp_enabled = !warp_enabled;
+	}
 	return;
-}//empty key functionality for now
+}
+
+void release_buffers() {
+	int i;
+
+	#ifdef RT_DEBUG
+	printf("frames published %u, dropped %u, drawn %u, stalls %u\n", depth_frames.published,
+		depth_frames.dropped, depth_frames.acquired, atomic_load(&depth_frames.stalls));
+	#endif
+	//the simulation stops with die like the depth thread
+	if (water_started) {
+		pthread_join(water_thread, NULL);
+	}
+	triplebuf_free(&depth_frames);
+	triplebuf_free(&water_terrain);
+	triplebuf_free(&water_layers);
+	water_free(&water);
+	workers_free(&water_workers);
+	temporal_ema_free(&depth_smoothing);
+	temporal_median_free(&depth_median);
+	spatial_holes_free(&depth_holes);
+	baseplane_free(&base_plane);
+	dem_free(&dem);
+	workers_free(&frame_workers);
+	projector_free(&projector);
+	free(colour_scratch);
+	tiles_free(&depth_tiles);
+	hillshade_free(&raw_relief);
+	hillshade_free(&height_relief);
+	colour_lut_free(&height_colours);
+	colour_lut_free(&map_colours);
+	for (i=0; i<3; i++) {
+		free(frame_stamps[i]);
+	}
+	free(texture_stamps);
+	occlusion_free(&occluders);
+	free(depth_clean);
+	free(depth_height);
+	free(depth_smoothed);
+}
+
+//heights run linearly from the top of the palette down, those beyond either end take its colour
+//the map's slots are the same heights, so both tables come out alike, slot for slot
+void build_height_colours() {
+	colour_lut_build(&height_colours, &palette, HEIGHT_TOP_MM, HEIGHT_BOTTOM_MM, 1);
+	colour_lut_build(&map_colours, &palette, HEIGHT_TOP_MM + COLOURMAP_HEIGHT_ZERO,
+		HEIGHT_BOTTOM_MM + COLOURMAP_HEIGHT_ZERO, 1);
+}
 
 int main(int argc, char** argv) {
 	int res;
 	int i;
-	int nr_devices;
-	int user_device_number;
-	depth_mid = (uint8_t*)malloc(640*480*3);
-	depth_front = (uint8_t*)malloc(640*480*3);
-	last_frame_clone = (uint8_t*)malloc(640*480*3);
+
+	headless_parse_args(&headless, &argc, argv);
+	if (headless.enabled && headless_sink_open(&frame_sink, headless.sink_spec, 640, 480) < 0) {
+		return 1;
+	}
+	headless_timing_init(&depth_timing, "depth_cb", headless.enabled);
+	stage_hands = headless_stage(&depth_timing, "hands");
+	stage_smooth = headless_stage(&depth_timing, "smooth");
+	stage_map = headless_stage(&depth_timing, "map");
+	stage_colour = headless_stage(&depth_timing, "colour");
+	stage_water = headless_stage(&depth_timing, "water");
+	stage_warp = headless_stage(&depth_timing, "warp");
+	calibrate_requested = headless.calibrate;
+
+	if (triplebuf_init(&depth_frames, 640*480*3) < 0) {
+		fprintf(stderr, "Failed to allocate frame buffers\n");
+		return 1;
+	}
+	depth_front = depth_frames.buffers[depth_frames.front];
+	depth_smoothed = (uint16_t*)malloc(640*480*sizeof(uint16_t));
+	depth_height = (int16_t*)malloc(640*480*sizeof(int16_t));
+	depth_clean = (uint16_t*)malloc(640*480*sizeof(uint16_t));
+	colour_scratch = (uint8_t*)malloc(640*480*3);
+	if (depth_smoothed == NULL || depth_height == NULL || depth_clean == NULL || colour_scratch == NULL || temporal_ema_init(&depth_smoothing, 640*480,
+			SMOOTH_ALPHA, SMOOTH_MOTION_THRESHOLD, SMOOTH_HOLD_FRAMES) < 0
+			|| temporal_median_init(&depth_median, 640*480, SMOOTH_MEDIAN_FRAMES) < 0
+			|| spatial_holes_init(&depth_holes, 640, 480, TEMPORAL_INVALID_DEPTH) < 0
+			|| baseplane_init(&base_plane) < 0
+			|| workers_init(&frame_workers, workers_default_count()) < 0
+			|| dem_init(&dem, 640, 480, &frame_workers) < 0
+			|| projector_init(&projector, 640, 480, 640, 480) < 0
+			|| tiles_init(&depth_tiles, 640, 480, TILES_SIZE, TILES_THRESHOLD) < 0
+			|| occlusion_init(&occluders, 640*480) < 0
+			|| hillshade_init(&raw_relief, 640) < 0
+			|| hillshade_init(&height_relief, 640) < 0
+			|| colour_lut_init(&height_colours, COLOURMAP_DOMAIN_HEIGHT, -COLOURMAP_HEIGHT_ZERO, COLOURMAP_SIZE, 0) < 0
+			|| colour_lut_init(&map_colours, COLOURMAP_DOMAIN_RAW, 0, COLOURMAP_SIZE, 0) < 0
+			//a pool of its own, the depth thread's may be busy with a frame whenever it steps
+			|| workers_init(&water_workers, workers_default_count()) < 0
+			|| water_init(&water, WATER_X, WATER_Y, WATER_CELL_MM, &water_workers) < 0
+			|| triplebuf_init(&water_terrain, WATER_X*WATER_Y*sizeof(float)) < 0
+			|| triplebuf_init(&water_layers, WATER_X*WATER_Y) < 0) {
+		fprintf(stderr, "Failed to allocate smoothing buffers\n");
+		return 1;
+	}
+	for (i=0; i<3; i++) {
+		frame_stamps[i] = tiles_alloc_stamps(&depth_tiles);
+	}
+	texture_stamps = tiles_alloc_stamps(&depth_tiles);
+	if (frame_stamps[0] == NULL || frame_stamps[1] == NULL || frame_stamps[2] == NULL || texture_stamps == NULL) {
+		fprintf(stderr, "Failed to allocate tile stamps\n");
+		return 1;
+	}
 
 	g_argc = argc;
 	g_argv = argv;
@@ -126,6 +414,26 @@ int main(int argc, char** argv) {
 		t_gamma[i] = v*6*256;
 	}
 
+	colourmap_default_palette(&palette);
+	if (colourmap_load_palette(&palette, COLOUR_INIT_PATH) > 0) {
+		printf("Loaded %d colours from %s\n", palette.count, COLOUR_INIT_PATH);
+	}
+	colourmap_build(&depth_colours, t_gamma, GAMMA_SPAN, &palette);
+
+	build_height_colours();
+	hillshade_build(&raw_relief, RELIEF_RAW_CELL);
+
+	//uncalibrated, nearer the camera is higher; the last slot of either is "no reading"
+	for (i=0; i<2048; i++) {
+		raw_terrain[i] = -occluders.mm[i];
+		map_terrain[i] = i - COLOURMAP_HEIGHT_ZERO;
+	}
+
+	if (projector_load(&projector, PROJECTOR_CAL_PATH) == 0) {
+		printf("Loaded projector corners from %s\n", PROJECTOR_CAL_PATH);
+		warp_enabled = 1;
+	}
+
 	#ifdef GL_CONTENT_DEBUG
 	int qtp;
 	for(qtp = 0; qtp < 2048; qtp+=50) {
@@ -133,9 +441,47 @@ int main(int argc, char** argv) {
 	}
 	#endif
 
+	if (pthread_create(&water_thread, NULL, water_threadfunc, NULL)) {
+		fprintf(stderr, "pthread_create failed\n");
+		return 1;
+	}
+	water_started = 1;
+
+	if (headless.synthetic) {
+		res = pthread_create(&freenect_thread, NULL, synthetic_threadfunc, NULL);
+	} else {
+		if (init_kinect(argc, argv) < 0) {
+			return 1;
+		}
+		res = pthread_create(&freenect_thread, NULL, freenect_threadfunc, NULL);
+	}
+	if (res) {
+		fprintf(stderr, "pthread_create failed\n");
+		if (!headless.synthetic) {
+			freenect_shutdown(f_ctx);
+		}
+		return 1;
+	}
+
+	if (headless.enabled) {
+		run_headless();
+		return 0;
+	}
+
+	/* OS X requires GLUT to run on the main thread */
+	gl_threadfunc(NULL);
+
+	return 0;
+}
+
+//opens the Kinect picked on the command line, returns 0 on success
+int init_kinect(int argc, char **argv) {
+	int nr_devices;
+	int user_device_number;
+
 	if (freenect_init(&f_ctx, NULL) < 0) {
 		fprintf(stderr, "freenect_init() failed\n");
-		return 1;
+		return -1;
 	}
 
     freenect_set_log_level(f_ctx, FREENECT_LOG_DEBUG);
@@ -153,26 +499,108 @@ int main(int argc, char** argv) {
 	} else if (nr_devices < 1) {
 		fprintf(stderr, "No devices detected");
 		freenect_shutdown(f_ctx);
-		return 1;
+		return -1;
 	}
 
 	if (freenect_open_device(f_ctx, &f_dev, user_device_number) < 0) {
 		fprintf(stderr, "Could not open device\n");
 		freenect_shutdown(f_ctx);
-		return 1;
+		return -1;
 	}
+	return 0;
+}
 
-	res = pthread_create(&freenect_thread, NULL, freenect_threadfunc, NULL);
-	if (res) {
-		fprintf(stderr, "pthread_create failed\n");
-		freenect_shutdown(f_ctx);
-		return 1;
+//stands in for the Kinect: generated frames straight into depth_cb, paced at 30Hz only when drawing
+void *synthetic_threadfunc(void *arg) {
+	uint16_t *frame = (uint16_t*)malloc(640*480*sizeof(uint16_t));
+	unsigned n = 0;
+
+	if (frame == NULL) {
+		die = 1;
+		return NULL;
+	}
+	while (!die) {
+		headless_synthetic_depth(frame, 640, 480, n);
+		depth_cb(NULL, frame, n*33);
+		n++;
+		if (!headless.enabled) {
+			usleep(33333);
+		}
 	}
+	free(frame);
+	return NULL;
+}
 
-	/* OS X requires GLUT to run on the main thread */
-	gl_threadfunc(NULL);
+//steps the water at a fixed rate over the latest terrain from depth_cb, and hands back its layers
+//a late tick is caught up straight away, up to a few, so the water keeps its pace when the camera's slow
+void *water_threadfunc(void *arg) {
+	const float *terrain = NULL;
+	double tick_ms = 1000.0 / WATER_HZ;
+	double next = headless_now_ms();
+	double now;
+	uint8_t *t;
+	int fresh;
+	int wet = 0;
+
+	while (!die) {
+		t = triplebuf_acquire(&water_terrain, &fresh);
+		if (fresh) {
+			terrain = (const float *)t;
+		}
+		if (water_clear_requested) {
+			water_clear_requested = 0;
+			water_clear(&water);
+		}
+		//nothing to flow over until depth_cb has sent terrain
+		if (terrain != NULL) {
+			water.rain = raining ? WATER_RAIN_MM_S : 0;
+			//dry and not raining, nothing can move; what's too shallow to show is left where it is
+			if (wet || raining) {
+				water_step(&water, terrain, 1.0f / WATER_HZ, WATER_SUBSTEPS);
+			}
+			wet = water_layer(&water, triplebuf_back(&water_layers));
+			triplebuf_publish(&water_layers);
+		}
+		next += tick_ms;
+		now = headless_now_ms();
+		if (next > now) {
+			usleep((useconds_t)((next - now) * 1000));
+		} else if (now - next > 4 * tick_ms) {
+			next = now;
+		}
+	}
+	return NULL;
+}
 
-	return 0;
+//takes the place of the GLUT loop: every new frame goes to the sink instead of the screen
+void run_headless() {
+	headless_timing_t sink_timing;
+	int stage_write;
+	uint8_t *frame;
+	int fresh;
+	double t0;
+
+	headless_timing_init(&sink_timing, "sink", 1);
+	stage_write = headless_stage(&sink_timing, "write");
+	while (!die) {
+		frame = triplebuf_acquire(&depth_frames, &fresh);
+		if (!fresh) {
+			usleep(1000);
+			continue;
+		}
+		t0 = headless_now_ms();
+		if (headless_sink_write(&frame_sink, frame, depth_frames.front_seq) < 0) {
+			die = 1;
+		}
+		headless_time(&sink_timing, stage_write, headless_now_ms() - t0);
+		headless_frame_done(&sink_timing);
+		if (headless.max_frames && frame_sink.written >= headless.max_frames) {
+			die = 1;
+		}
+	}
+	pthread_join(freenect_thread, NULL);
+	headless_sink_close(&frame_sink);
+	release_buffers();
 }
 
 void InitGL(int Width, int Height)
@@ -194,6 +622,25 @@ void InitGL(int Width, int Height)
 	glBindTexture(GL_TEXTURE_2D, gl_depth_tex);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	//storage is allocated once here, frames only replace its contents
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, 640, 480, 0, GL_RGB, GL_UNSIGNED_BYTE, depth_front);
+
+	//pixel buffer objects are core from GL 2.1
+	const char *version = (const char *)glGetString(GL_VERSION);
+	const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+	int major = 0, minor = 0;
+	if (version != NULL) {
+		sscanf(version, "%d.%d", &major, &minor);
+	}
+	use_pbo = major > 2 || (major == 2 && minor >= 1)
+		|| (extensions != NULL && strstr(extensions, "GL_ARB_pixel_buffer_object") != NULL);
+	if (use_pbo) {
+		glGenBuffers(2, gl_depth_pbo);
+	}
+	#ifdef RT_DEBUG
+	printf("GL %s, %s texture uploads\n", version ? version : "?", use_pbo ? "streaming" : "direct");
+	#endif
 
 	ReSizeGLScene(Width, Height);
 }
@@ -225,6 +672,8 @@ void *freenect_threadfunc(void *arg) {
 	#ifdef RT_DEBUG
 	printf("<freenect_threadfunc> done!\n");
 	#endif
+	//a headless loop has nothing left to wait for
+	die = 1;
 	return NULL;
 }
 
@@ -241,50 +690,128 @@ void *gl_threadfunc(void *arg) {
 	window = glutCreateWindow("osx topography"); /* window title edit */
 
 	glutDisplayFunc(&DrawGLScene);
-	glutIdleFunc(&DrawGLScene);
 	glutReshapeFunc(&ReSizeGLScene);
 	glutKeyboardFunc(&keyPressed);
+	glutMouseFunc(&mouse_pressed);
 
 	InitGL(640, 480);
+	enable_vsync();
+	//no idle func: the pacer asks for a redraw when depth_cb has published something new
+	glutTimerFunc(PACER_POLL_MS, frame_pacer, 0);
 
 	glutMainLoop();
 
 	return NULL;
 }
 
-void DrawGLScene()
-{
-	pthread_mutex_lock(&gl_backbuf_mutex);
+//polls for new frames and schedules a redraw, never more than one per display refresh
+void frame_pacer(int value) {
+	double refresh_ms = 1000.0 / PACER_REFRESH_HZ;
+	double since = headless_now_ms() - last_draw_ms;
+	int delay = PACER_POLL_MS;
 
-	// When using YUV_RGB mode, RGB frames only arrive at 15Hz, so we shouldn't force them to draw in lock-step.
-	// However, this is CPU/GPU intensive when we are receiving frames in lockstep.
-	if (current_format == FREENECT_VIDEO_YUV_RGB) {
-		while (!got_depth) {
-			pthread_cond_wait(&gl_frame_cond, &gl_backbuf_mutex);
+	if (die) {
+		return;
+	}
+	if (triplebuf_pending(&depth_frames)) {
+		if (since >= refresh_ms - PACER_POLL_MS) {
+			glutPostRedisplay();
+		} else {
+			//a frame is waiting, come back in time for the next refresh
+			delay = (int)(refresh_ms - since);
 		}
-	} /*else {
-		while ((!got_depth || !got_rgb) && requested_format != current_format) {
-			pthread_cond_wait(&gl_frame_cond, &gl_backbuf_mutex);
+	}
+	glutTimerFunc(delay < 1 ? 1 : delay, frame_pacer, 0);
+}
+
+//ask for swaps to wait for vertical retrace, where the platform lets us
+void enable_vsync() {
+#if defined(__APPLE__)
+	GLint one = 1;
+	CGLSetParameter(CGLGetCurrentContext(), kCGLCPSwapInterval, &one);
+#elif defined(__linux__)
+	typedef int (*swap_interval_fn)(int);
+	swap_interval_fn swap_interval = (swap_interval_fn)glXGetProcAddressARB((const GLubyte *)"glXSwapIntervalMESA");
+	if (swap_interval == NULL) {
+		swap_interval = (swap_interval_fn)glXGetProcAddressARB((const GLubyte *)"glXSwapIntervalSGI");
+	}
+	if (swap_interval != NULL) {
+		swap_interval(1);
+	}
+#endif
+}
+
+//brings the texture up to date with frame, whose tiles were coloured as of stamps
+//only tiles that differ from what the texture holds are sent, through a freshly orphaned
+//pixel buffer so the copy to the GPU runs asynchronously
+void upload_depth_texture(uint8_t *frame, const uint32_t *stamps) {
+	void *dst = NULL;
+	int tile, run, x, y, w, h, row;
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 640);
+	if (use_pbo) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gl_depth_pbo[gl_pbo_next]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, 640*480*3, NULL, GL_STREAM_DRAW);
+		dst = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+		if (dst != NULL) {
+			//the changed tiles go in at the same offsets they have in the frame
+			for (tile = 0; tiles_next_stale(&depth_tiles, texture_stamps, stamps, &tile, &run); tile += run) {
+				tiles_rect(&depth_tiles, tile, run, &x, &y, &w, &h);
+				for (row = y; row < y + h; row++) {
+					memcpy((uint8_t *)dst + 3*(row*640 + x), frame + 3*(row*640 + x), 3*w);
+				}
+			}
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			for (tile = 0; tiles_next_stale(&depth_tiles, texture_stamps, stamps, &tile, &run); tile += run) {
+				tiles_rect(&depth_tiles, tile, run, &x, &y, &w, &h);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGB, GL_UNSIGNED_BYTE, (void *)(intptr_t)(3*(y*640 + x)));
+			}
 		}
-	}*/
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		gl_pbo_next ^= 1;
+	}
+	if (dst == NULL) {
+		for (tile = 0; tiles_next_stale(&depth_tiles, texture_stamps, stamps, &tile, &run); tile += run) {
+			tiles_rect(&depth_tiles, tile, run, &x, &y, &w, &h);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGB, GL_UNSIGNED_BYTE, frame + 3*(y*640 + x));
+		}
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	memcpy(texture_stamps, stamps, depth_tiles.count * sizeof(uint32_t));
+}
 
-	if (requested_format != current_format) {
-		pthread_mutex_unlock(&gl_backbuf_mutex);
-		return;
+//fps of new frames drawn and the time from depth_cb to the swap, averaged each second
+void draw_stats() {
+	char text[64];
+	char *c;
+
+	snprintf(text, sizeof(text), "%.1f fps  %.1f ms", shown_fps, shown_latency_ms);
+	glDisable(GL_TEXTURE_2D);
+	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+	glRasterPos2f(8, 480-18);
+	for (c = text; *c; c++) {
+		glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
 	}
+	glEnable(GL_TEXTURE_2D);
+}
 
-	uint8_t *tmp;
+void DrawGLScene()
+{
+	int fresh;
+	double now;
 
-	if (got_depth) {
-		tmp = depth_front;
-		depth_front = depth_mid;
-		depth_mid = tmp;
-		got_depth = 0;
+	if (requested_format != current_format) {
+		return;
 	}
 
-	pthread_mutex_unlock(&gl_backbuf_mutex);
+	//takes the newest frame from depth_cb, if any, without waiting on it
+	depth_front = triplebuf_acquire(&depth_frames, &fresh);
+
 	glBindTexture(GL_TEXTURE_2D, gl_depth_tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, 640, 480, 0, GL_RGB, GL_UNSIGNED_BYTE, depth_front);
+	//expose/reshape redraws reuse what is already on the GPU
+	if (fresh) {
+		upload_depth_texture(depth_front, frame_stamps[depth_frames.front]);
+	}
 
 	camera_angle = 0.0;
 
@@ -316,23 +843,48 @@ void DrawGLScene()
 	glTexCoord2f(0, 0); glVertex3f(640,480,0);
 	glEnd();
 	glPopMatrix();
-	
-	render_contour(depth_front);
-	memmove(last_frame_clone, depth_front, 640*480*3);
+
+	if (show_stats) {
+		draw_stats();
+	}
 
 	glutSwapBuffers();
+
+	now = headless_now_ms();
+	last_draw_ms = now;
+	if (fresh) {
+		stats_frames++;
+		stats_latency_ms += now - depth_frame_ms[depth_frames.front];
+	}
+	if (now - stats_window_start >= 1000) {
+		shown_fps = stats_frames * 1000.0 / (now - stats_window_start);
+		shown_latency_ms = stats_frames ? stats_latency_ms / stats_frames : 0;
+		stats_frames = 0;
+		stats_latency_ms = 0;
+		stats_window_start = now;
+	}
 }
 
-void render_contour(uint8_t * m) {
-	int q;
-	for(q=0;q<640*480*3;q++) {
-		m[q] = m[q]/2;
-		m[q] += (last_frame_clone[q]/2);
+//collects the projector corners after 'p', in frame pixels
+void mouse_pressed(int button, int state, int x, int y) {
+	int corner;
+
+	if (!picking || button != GLUT_LEFT_BUTTON || state != GLUT_DOWN) {
+		return;
+	}
+	corner = 4 - picking;
+	picked_corners[corner][0] = x * 640.0f / window_width;
+	picked_corners[corner][1] = y * 480.0f / window_height;
+	picking--;
+	if (!picking) {
+		//the corners are written before the flag, depth_cb reads them after it
+		atomic_store_explicit(&projector_update_requested, 1, memory_order_release);
 	}
-	return;
 }
 
 void ReSizeGLScene(int Width, int Height) {
+	window_width = Width > 0 ? Width : 1;
+	window_height = Height > 0 ? Height : 1;
 	glViewport(0,0,Width,Height);
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
@@ -342,61 +894,197 @@ void ReSizeGLScene(int Width, int Height) {
 }
 
 void depth_cb(freenect_device *dev, void *v_depth, uint32_t timestamp) {
-	int i;
-	int pval;
-	int lb;
 	uint16_t *depth = (uint16_t*)v_depth;
-
-	pthread_mutex_lock(&gl_backbuf_mutex);
-	
-	for (i=0; i<640*480; i++) {
-		pval = t_gamma[depth[i]];
-		lb = pval & 0xff;
-		switch (pval>>8) {
-			case 0:
-				depth_mid[(3*i)+0] = 255;
-				depth_mid[(3*i)+1] = 255-lb;
-				depth_mid[(3*i)+2] = 255-lb;
-				break;
-			case 1:
-				depth_mid[(3*i)+0] = 255;
-				depth_mid[(3*i)+1] = lb;
-				depth_mid[(3*i)+2] = 0;
-				break;
-			case 2:
-				depth_mid[(3*i)+0] = 255-lb;
-				depth_mid[(3*i)+1] = 255;
-				depth_mid[(3*i)+2] = 0;
-				break;
-			case 3:
-				depth_mid[(3*i)+0] = 0;
-				depth_mid[(3*i)+1] = 255;
-				depth_mid[(3*i)+2] = lb;
-				break;
-			case 4:
-				depth_mid[(3*i)+0] = 0;
-				depth_mid[(3*i)+1] = 255-lb;
-				depth_mid[(3*i)+2] = 255;
-				break;
-			case 5:
-				depth_mid[(3*i)+0] = 0;
-				depth_mid[(3*i)+1] = 0;
-				depth_mid[(3*i)+2] = 255-lb;
-				break;
-			default:
-				/*depth_mid[(3*i)+0] = 0;
-				depth_mid[(3*i)+1] = 0;
-				depth_mid[(3*i)+2] = 0;*/
-				break;
+	//private to this thread until published
+	uint8_t *depth_mid = triplebuf_back(&depth_frames);
+	uint8_t *colour_out;
+	uint32_t *stamps = frame_stamps[depth_frames.back];
+	int warping, shading;
+	int path;
+	int tile, run, x, y, w, h, row;
+	uint8_t *layer;
+	int wet, fresh;
+	double t0, t1;
+
+	t0 = headless_now_ms();
+	//published along with the frame, the GL thread reads it once it owns the buffer
+	depth_frame_ms[depth_frames.back] = t0;
+	//before anything else sees the frame, so hands never reach the smoothing or the map
+	if (reject_hands) {
+		//switched back on, the model starts over from this frame, which should be bare sand
+		if (!hands_rejected) {
+			occlusion_reset(&occluders);
+		}
+		occlusion_apply(&occluders, depth, depth_clean);
+		depth = depth_clean;
+		t1 = headless_now_ms();
+		headless_time(&depth_timing, stage_hands, t1 - t0);
+		t0 = t1;
+	}
+	hands_rejected = reject_hands;
+	//smooth heights rather than colours, once per frame on this thread
+	if (use_median) {
+		temporal_median_apply(&depth_median, depth, depth_smoothed);
+	} else {
+		temporal_ema_apply(&depth_smoothing, depth, depth_smoothed);
+	}
+	if (calibrate_requested) {
+		calibrate_requested = 0;
+		//synthetic frames have no device, they're fitted with a typical Kinect's tables
+		if (baseplane_calibrate(&base_plane, dev, depth_smoothed) < 0) {
+			fprintf(stderr, "No base plane found, is the sandbox empty?\n");
+		} else {
+			dem_ready = dem_setup(&dem, &base_plane, DEM_CELL_MM) == 0;
+			//the map's cells just fit the camera's view, so they're about a pixel of it too
+			hillshade_build(&height_relief, dem.cell_mm);
+			tiles_invalidate(&depth_tiles);
+			//distances from the camera's own table from now on
+			occlusion_set_mm(&occluders, base_plane.mm);
+			#ifdef RT_DEBUG
+			printf("base plane %f %f %f %f, %d inliers\n", base_plane.normal[0], base_plane.normal[1],
+				base_plane.normal[2], base_plane.offset, base_plane.inliers);
+			printf("map cells %.2f mm\n", dem.cell_mm);
+			#endif
+		}
+	}
+	if (palette_reload_requested) {
+		palette_reload_requested = 0;
+		if (colourmap_load_palette(&palette, COLOUR_INIT_PATH) < 0) {
+			fprintf(stderr, "No usable palette in %s, keeping the old one\n", COLOUR_INIT_PATH);
+		} else {
+			colourmap_build(&depth_colours, t_gamma, GAMMA_SPAN, &palette);
+			build_height_colours();
+			tiles_invalidate(&depth_tiles);
 		}
 	}
+	if (atomic_load_explicit(&projector_update_requested, memory_order_acquire)) {
+		atomic_store_explicit(&projector_update_requested, 0, memory_order_relaxed);
+		if (projector_set_corners(&projector, picked_corners) < 0) {
+			fprintf(stderr, "Those corners do not make a projector mapping\n");
+		} else {
+			if (projector_save(&projector, PROJECTOR_CAL_PATH) < 0) {
+				fprintf(stderr, "Could not save %s\n", PROJECTOR_CAL_PATH);
+			}
+			warp_enabled = 1;
+		}
+	}
+	//when warping, colours go to the scratch frame and the warp writes the published one
+	warping = warp_enabled && projector.valid;
+	shading = shade_relief;
+	colour_out = warping ? colour_scratch : depth_mid;
+	t1 = headless_now_ms();
+	headless_time(&depth_timing, stage_smooth, t1 - t0);
+
+	t0 = t1;
+	if (dem_ready && map_view) {
+		path = COLOUR_PATH_MAP;
+	} else {
+		//shadows and specular sand read as 2047, paint them from their surroundings
+		spatial_fill_holes(&depth_holes, depth_smoothed, depth_smoothed);
+		path = base_plane.valid ? COLOUR_PATH_HEIGHT : COLOUR_PATH_RAW;
+	}
+	//water laid over another view's sand is in the wrong place, it drains and starts over
+	if (path != water_path) {
+		water_clear_requested = 1;
+	}
+	layer = triplebuf_acquire(&water_layers, &fresh);
+	wet = path == water_path && water_wet(&water, layer);
+	//the map and the warp move pixels across tiles, they redo the whole frame; so does water, it's blended over the colours
+	if (path != colour_path || path == COLOUR_PATH_MAP || warping || colour_warped || show_occluders || colour_masked
+			|| wet || water_shown || shading != colour_shaded) {
+		tiles_invalidate(&depth_tiles);
+	}
+	colour_path = path;
+	colour_warped = warping;
+	colour_shaded = shading;
+	colour_masked = show_occluders && reject_hands && path != COLOUR_PATH_MAP;
+	tiles_update(&depth_tiles, depth_smoothed);
+
+	if (path == COLOUR_PATH_MAP) {
+		//the map fills its own gaps, sampled from the unfilled frame
+		dem_generate(&dem, depth_smoothed);
+		t1 = headless_now_ms();
+		if (shading) {
+			hillshade_apply(&height_relief, map_colours.lut, dem.raster, 640, 480, 0, 0, 640, 480, colour_out);
+		} else {
+			colour_lut_apply(&map_colours, dem.raster, colour_out, 640*480);
+		}
+	} else {
+		t1 = headless_now_ms();
+		//this buffer last held a frame or two ago, it needs the tiles that changed since
+		for (tile = 0; tiles_next_stale(&depth_tiles, stamps, depth_tiles.changed, &tile, &run); tile += run) {
+			tiles_rect(&depth_tiles, tile, run, &x, &y, &w, &h);
+			for (row = y; row < y + h; row++) {
+				int p = row*640 + x;
+				if (path == COLOUR_PATH_HEIGHT) {
+					baseplane_height_run(&base_plane, depth_smoothed, depth_height, p, w);
+					if (!shading) {
+						colour_lut_apply_height(&height_colours, depth_height + p, colour_out + 3*p, w);
+					}
+				} else if (!shading) {
+					colourmap_apply(&depth_colours, depth_smoothed + p, colour_out + 3*p, w);
+				}
+			}
+		}
+		//shading looks HILLSHADE_REACH into the tiles around, so every height is in before any is shaded,
+		//and a change relights as far into the tiles left alone
+		if (shading) {
+			for (tile = 0; tiles_next_stale(&depth_tiles, stamps, depth_tiles.changed, &tile, &run); tile += run) {
+				tiles_rect(&depth_tiles, tile, run, &x, &y, &w, &h);
+				w = (x + w + HILLSHADE_REACH < 640 ? x + w + HILLSHADE_REACH : 640);
+				h = (y + h + HILLSHADE_REACH < 480 ? y + h + HILLSHADE_REACH : 480);
+				x = (x > HILLSHADE_REACH ? x - HILLSHADE_REACH : 0);
+				y = (y > HILLSHADE_REACH ? y - HILLSHADE_REACH : 0);
+				w -= x;
+				h -= y;
+				if (path == COLOUR_PATH_HEIGHT) {
+					hillshade_apply_height(&height_relief, height_colours.lut, depth_height, 640, 480, x, y, w, h, colour_out);
+				} else {
+					hillshade_apply(&raw_relief, depth_colours.lut, depth_smoothed, 640, 480, x, y, w, h, colour_out);
+				}
+			}
+		}
+	}
+	tiles_stamp(&depth_tiles, stamps);
+	if (colour_masked) {
+		for (row = 0; row < 640*480; row++) {
+			if (occluders.mask[row]) {
+				colour_out[3*row] = 255;
+				colour_out[3*row+1] = 0;
+				colour_out[3*row+2] = 255;
+			}
+		}
+	}
+	headless_time(&depth_timing, stage_map, t1 - t0);
+	t0 = headless_now_ms();
+	headless_time(&depth_timing, stage_colour, t0 - t1);
+
+	//the water's terrain is the frame's own heights, two pixels a side to the cell
+	if (path == COLOUR_PATH_MAP) {
+		water_terrain_slots(&water, dem.raster, 640, map_terrain, (float *)triplebuf_back(&water_terrain));
+	} else if (path == COLOUR_PATH_HEIGHT) {
+		water_terrain_heights(&water, depth_height, 640, (float *)triplebuf_back(&water_terrain));
+	} else {
+		water_terrain_slots(&water, depth_smoothed, 640, raw_terrain, (float *)triplebuf_back(&water_terrain));
+	}
+	triplebuf_publish(&water_terrain);
+	water_path = path;
+	if (wet) {
+		water_blend(&water, layer, colour_out, 640, 480);
+	}
+	water_shown = wet;
+	t1 = headless_now_ms();
+	headless_time(&depth_timing, stage_water, t1 - t0);
+	t0 = t1;
+	if (warping) {
+		projector_apply(&projector, colour_scratch, depth_mid);
+		headless_time(&depth_timing, stage_warp, headless_now_ms() - t0);
+	}
 
 	/*for(i=0;i<640*480;i++) {
 		depth_mid[(3*i)] = (uint8_t)((depth[i]) % 256);
 	}*/
 
-	got_depth++;
-	pthread_cond_signal(&gl_frame_cond);
-	pthread_mutex_unlock(&gl_backbuf_mutex);
+	triplebuf_publish(&depth_frames);
+	headless_frame_done(&depth_timing);
 }
-
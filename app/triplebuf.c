@@ -0,0 +1,116 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "triplebuf.h"
+
+#define TB_INDEX_MASK 0x3
+#define TB_FRESH 0x4
+#define TB_SEQ_SHIFT 3
+
+//allocates three zeroed buffers of size bytes, returns 0 on success
+int triplebuf_init(triplebuf_t * tb, size_t size) {
+	int i;
+	memset(tb, 0, sizeof(*tb));
+	for(i=0;i<3;i++) {
+		tb->buffers[i] = (uint8_t *)calloc(1, size);
+		if(tb->buffers[i] == NULL) {
+			triplebuf_free(tb);
+			return -1;
+		}
+	}
+	tb->back = 0;
+	atomic_init(&tb->state, 1);
+	tb->front = 2;
+	return 0;
+}
+
+void triplebuf_free(triplebuf_t * tb) {
+	int i;
+	for(i=0;i<3;i++) {
+		free(tb->buffers[i]);
+		tb->buffers[i] = NULL;
+	}
+}
+
+//the buffer the producer should fill next
+uint8_t * triplebuf_back(triplebuf_t * tb) {
+	return tb->buffers[tb->back];
+}
+
+//producer: swap the filled back buffer into mid, returns the frame's sequence number
+uint32_t triplebuf_publish(triplebuf_t * tb) {
+	uint32_t old = atomic_load_explicit(&tb->state, memory_order_relaxed);
+	uint32_t next;
+
+	do {
+		next = ((old >> TB_SEQ_SHIFT) + 1) << TB_SEQ_SHIFT | TB_FRESH | tb->back;
+		//release: the consumer must see the finished frame along with the index
+		if(atomic_compare_exchange_strong_explicit(&tb->state, &old, next, memory_order_acq_rel, memory_order_relaxed)) {
+			break;
+		}
+		atomic_fetch_add_explicit(&tb->stalls, 1, memory_order_relaxed);
+	} while(1);
+
+	if(old & TB_FRESH) {
+		tb->dropped++;
+	}
+	tb->published++;
+	tb->back = old & TB_INDEX_MASK;
+	return next >> TB_SEQ_SHIFT;
+}
+
+//consumer: takes the latest frame if there is one, otherwise keeps the current front
+//sets *fresh (if given) to 1 when the returned buffer is new since the last call
+uint8_t * triplebuf_acquire(triplebuf_t * tb, int * fresh) {
+	uint32_t old = atomic_load_explicit(&tb->state, memory_order_acquire);
+	uint32_t next;
+
+	if(fresh != NULL) {
+		*fresh = 0;
+	}
+	while(old & TB_FRESH) {
+		next = (old & ~(TB_INDEX_MASK | TB_FRESH)) | tb->front;
+		if(atomic_compare_exchange_strong_explicit(&tb->state, &old, next, memory_order_acq_rel, memory_order_acquire)) {
+			tb->front = old & TB_INDEX_MASK;
+			tb->front_seq = old >> TB_SEQ_SHIFT;
+			tb->acquired++;
+			if(fresh != NULL) {
+				*fresh = 1;
+			}
+			break;
+		}
+		atomic_fetch_add_explicit(&tb->stalls, 1, memory_order_relaxed);
+	}
+	return tb->buffers[tb->front];
+}
+
+//consumer: 1 if a frame newer than front is waiting, without taking it
+int triplebuf_pending(triplebuf_t * tb) {
+	return (atomic_load_explicit(&tb->state, memory_order_acquire) & TB_FRESH) != 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/** triplebuf_t
+	Single producer / single consumer frame handoff without locks.
+	back: owned by the producer, being filled
+	mid: shared, "latest frame ready"
+	front: owned by the consumer, "currently being drawn"
+	Publishing and acquiring are a single compare-and-swap on the shared
+	state word each, so neither side ever waits for the other.
+**/
+typedef struct {
+	uint8_t * buffers[3];
+	int back;
+	int front;
+	uint32_t front_seq;		//sequence number of the frame in front
+	_Atomic uint32_t state;	//mid index (bits 0-1), fresh flag (bit 2), sequence number (bits 3-31)
+
+	//statistics, each only written by one side
+	uint32_t published;
+	uint32_t dropped;		//frames replaced in mid before the consumer took them
+	uint32_t acquired;
+	_Atomic uint32_t stalls;	//compare-and-swap retries, the only point where one side sees the other
+} triplebuf_t;
+
+int triplebuf_init(triplebuf_t *, size_t);
+void triplebuf_free(triplebuf_t *);
+uint8_t * triplebuf_back(triplebuf_t *);
+uint32_t triplebuf_publish(triplebuf_t *);
+uint8_t * triplebuf_acquire(triplebuf_t *, int *);
+int triplebuf_pending(triplebuf_t *);
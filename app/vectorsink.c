@@ -0,0 +1,359 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "vectorsink.h"
+
+//worst case text per point and per line around its points, checked before each line goes in
+#define POINT_BYTES 32
+#define LINE_BYTES 192
+#define FRAME_END_BYTES 16
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+//pulls the vector export switches out of argv, leaving the rest in order
+void vector_parse_args(vector_options_t * opt, int * argc, char ** argv) {
+	int i;
+	int kept = 1;
+
+	memset(opt, 0, sizeof(*opt));
+	opt->tolerance = 0.5f;
+	for(i=1;i<*argc;i++) {
+		if(strncmp(argv[i], "--vectors=", 10) == 0) {
+			opt->spec = argv[i] + 10;
+		} else if(strncmp(argv[i], "--vector-tolerance=", 19) == 0) {
+			opt->tolerance = strtof(argv[i] + 19, NULL);
+		} else {
+			argv[kept++] = argv[i];
+		}
+	}
+	argv[kept] = NULL;
+	*argc = kept;
+}
+
+static int open_socket(const char * path) {
+	struct sockaddr_un addr;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if(fd < 0) {
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	//a slow reader loses frames rather than holding up the depth thread
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+//opens the sink described by spec (FORMAT:DEST, see vector_options_t), NULL opens nothing
+//returns 0 on success
+int vector_sink_open(vector_sink_t * sink, const char * spec, int width, int height, float tolerance) {
+	const char * dest;
+
+	memset(sink, 0, sizeof(*sink));
+	sink->fd = -1;
+	sink->width = width;
+	sink->height = height;
+	sink->tolerance = tolerance > 0 ? tolerance : 0;
+	if(spec == NULL) {
+		return 0;
+	}
+	if(strncmp(spec, "geojson:", 8) == 0) {
+		sink->format = VECTOR_SINK_GEOJSON;
+		dest = spec + 8;
+	} else if(strncmp(spec, "svg:", 4) == 0) {
+		sink->format = VECTOR_SINK_SVG;
+		dest = spec + 4;
+	} else {
+		fprintf(stderr, "Unknown vector format %s, expected geojson:DEST or svg:DEST\n", spec);
+		return -1;
+	}
+
+	sink->arena = (char *)malloc(VECTOR_SINK_ARENA_BYTES);
+	sink->keep = (uint8_t *)malloc(VECTOR_SINK_MAX_POINTS);
+	sink->stack = (int32_t *)malloc(VECTOR_SINK_MAX_POINTS * 2 * sizeof(int32_t));
+	if(sink->arena == NULL || sink->keep == NULL || sink->stack == NULL) {
+		fprintf(stderr, "Failed to allocate the vector arena\n");
+		vector_sink_close(sink);
+		return -1;
+	}
+
+	if(strcmp(dest, "-") == 0) {
+		//the lines get the real stdout to themselves, everything printed from here on goes to stderr
+		fflush(stdout);
+		sink->fd = dup(STDOUT_FILENO);
+		if(sink->fd >= 0 && dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+			close(sink->fd);
+			sink->fd = -1;
+		}
+	} else if(strncmp(dest, "unix:", 5) == 0) {
+		sink->is_socket = 1;
+		sink->fd = open_socket(dest + 5);
+	} else {
+		sink->fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if(sink->fd < 0) {
+		fprintf(stderr, "Could not open %s for contour lines: %s\n", dest, strerror(errno));
+		vector_sink_close(sink);
+		return -1;
+	}
+	return 0;
+}
+
+void vector_sink_close(vector_sink_t * sink) {
+	if(sink->fd >= 0) {
+		close(sink->fd);
+		sink->fd = -1;
+	}
+	free(sink->arena);
+	free(sink->keep);
+	free(sink->stack);
+	sink->arena = NULL;
+	sink->keep = NULL;
+	sink->stack = NULL;
+	sink->format = VECTOR_SINK_NONE;
+}
+
+static char * put_str(char * p, const char * s) {
+	while(*s) {
+		*p++ = *s++;
+	}
+	return p;
+}
+
+static char * put_int(char * p, long v) {
+	char digits[24];
+	int n = 0;
+	unsigned long u = v < 0 ? -(unsigned long)v : (unsigned long)v;
+
+	if(v < 0) {
+		*p++ = '-';
+	}
+	do {
+		digits[n++] = (char)('0' + u % 10);
+		u /= 10;
+	} while(u);
+	while(n) {
+		*p++ = digits[--n];
+	}
+	return p;
+}
+
+//two decimals, plenty below a pixel and much cheaper than printf
+static char * put_fixed(char * p, float v) {
+	long c = lrintf(v * 100);
+	long a = c < 0 ? -c : c;
+
+	if(c < 0) {
+		*p++ = '-';
+	}
+	p = put_int(p, a / 100);
+	*p++ = '.';
+	*p++ = (char)('0' + (a / 10) % 10);
+	*p++ = (char)('0' + a % 10);
+	return p;
+}
+
+//Douglas-Peucker over count points, marks the ones to keep in sink->keep and returns how many
+static int simplify(vector_sink_t * sink, const float * pts, int count) {
+	float tol2 = sink->tolerance * sink->tolerance;
+	uint8_t * keep = sink->keep;
+	int32_t * stack = sink->stack;
+	int top = 0;
+	int kept = 2;
+	int i;
+
+	memset(keep, 0, count);
+	keep[0] = 1;
+	keep[count - 1] = 1;
+	stack[top++] = 0;
+	stack[top++] = count - 1;
+	while(top > 0) {
+		int b = stack[--top];
+		int a = stack[--top];
+		float ax = pts[a * 2], ay = pts[a * 2 + 1];
+		float dx = pts[b * 2] - ax, dy = pts[b * 2 + 1] - ay;
+		float len2 = dx * dx + dy * dy;
+		float worst = 0;
+		int split = -1;
+
+		for(i=a+1;i<b;i++) {
+			float px = pts[i * 2] - ax, py = pts[i * 2 + 1] - ay;
+			float cross = px * dy - py * dx;
+			//closed lines start and end on the same point, measure from it instead
+			float d2 = len2 > 0 ? cross * cross / len2 : px * px + py * py;
+			if(d2 > worst) {
+				worst = d2;
+				split = i;
+			}
+		}
+		if(split >= 0 && worst > tol2) {
+			keep[split] = 1;
+			kept++;
+			//each split leaves both halves strictly shorter, so the stack never outgrows count pairs
+			stack[top++] = a;
+			stack[top++] = split;
+			stack[top++] = split;
+			stack[top++] = b;
+		}
+	}
+	return kept;
+}
+
+//sends what is left of the arena without waiting on a socket, returns -1 once the destination is gone
+static int flush_arena(vector_sink_t * sink) {
+	while(sink->sent < sink->used) {
+		ssize_t n;
+		if(sink->is_socket) {
+			n = send(sink->fd, sink->arena + sink->sent, sink->used - sink->sent, MSG_NOSIGNAL);
+		} else {
+			n = write(sink->fd, sink->arena + sink->sent, sink->used - sink->sent);
+		}
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;
+		}
+		if(n < 0) {
+			fprintf(stderr, "Contour line output failed: %s\n", strerror(errno));
+			vector_sink_close(sink);
+			return -1;
+		}
+		sink->sent += n;
+	}
+	return 0;
+}
+
+//formats the lines as one line of text and sends it, levels are at start + level * interval
+//returns 0 on success, -1 once the sink has failed and closed
+int vector_sink_write(vector_sink_t * sink, const isoline_set_t * set, float start, float interval, uint32_t frame) {
+	char * p;
+	char * end;
+	int s, i;
+
+	if(sink->format == VECTOR_SINK_NONE) {
+		return 0;
+	}
+	//the reader is still taking an earlier frame, which has to go out whole
+	if(sink->sent < sink->used) {
+		if(flush_arena(sink) < 0) {
+			return -1;
+		}
+		if(sink->sent < sink->used) {
+			sink->dropped++;
+			return 0;
+		}
+	}
+	p = sink->arena;
+	end = sink->arena + VECTOR_SINK_ARENA_BYTES - FRAME_END_BYTES;
+
+	if(sink->format == VECTOR_SINK_GEOJSON) {
+		p = put_str(p, "{\"type\":\"FeatureCollection\",\"frame\":");
+		p = put_int(p, frame);
+		p = put_str(p, ",\"features\":[");
+	} else {
+		p = put_str(p, "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"0 0 ");
+		p = put_int(p, sink->width);
+		p = put_str(p, " ");
+		p = put_int(p, sink->height);
+		p = put_str(p, "\" data-frame=\"");
+		p = put_int(p, frame);
+		p = put_str(p, "\">");
+	}
+
+	for(s=0;s<set->strip_count;s++) {
+		const isoline_strip_t * strip = &set->strips[s];
+		const float * pts = set->points + strip->start * 2;
+		int decimate = sink->tolerance > 0 && strip->count > 2 && strip->count <= VECTOR_SINK_MAX_POINTS;
+		int kept = decimate ? simplify(sink, pts, strip->count) : strip->count;
+		int first = 1;
+
+		if(p + LINE_BYTES + (size_t)kept * POINT_BYTES > end) {
+			sink->truncated++;
+			break;
+		}
+		if(sink->format == VECTOR_SINK_GEOJSON) {
+			if(s > 0) {
+				*p++ = ',';
+			}
+			p = put_str(p, "{\"type\":\"Feature\",\"properties\":{\"level\":");
+			p = put_int(p, strip->level);
+			p = put_str(p, ",\"depth\":");
+			p = put_fixed(p, start + strip->level * interval);
+			p = put_str(p, strip->closed ? ",\"closed\":true}" : ",\"closed\":false}");
+			p = put_str(p, ",\"geometry\":{\"type\":\"LineString\",\"coordinates\":[");
+		} else {
+			p = put_str(p, "<polyline data-level=\"");
+			p = put_int(p, strip->level);
+			p = put_str(p, "\" data-depth=\"");
+			p = put_fixed(p, start + strip->level * interval);
+			p = put_str(p, "\" fill=\"none\" stroke=\"black\" points=\"");
+		}
+		for(i=0;i<strip->count;i++) {
+			if(decimate && !sink->keep[i]) {
+				continue;
+			}
+			if(sink->format == VECTOR_SINK_GEOJSON) {
+				p = put_str(p, first ? "[" : ",[");
+				p = put_fixed(p, pts[i * 2]);
+				*p++ = ',';
+				p = put_fixed(p, pts[i * 2 + 1]);
+				*p++ = ']';
+			} else {
+				if(!first) {
+					*p++ = ' ';
+				}
+				p = put_fixed(p, pts[i * 2]);
+				*p++ = ',';
+				p = put_fixed(p, pts[i * 2 + 1]);
+			}
+			first = 0;
+		}
+		p = put_str(p, sink->format == VECTOR_SINK_GEOJSON ? "]}}" : "\"/>");
+	}
+	p = put_str(p, sink->format == VECTOR_SINK_GEOJSON ? "]}\n" : "</svg>\n");
+	sink->used = p - sink->arena;
+	sink->sent = 0;
+	sink->written++;
+	return flush_arena(sink);
+}
@@ -0,0 +1,83 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "isolines.h"
+
+#define VECTOR_SINK_ARENA_BYTES (4 << 20)
+#define VECTOR_SINK_MAX_POINTS 65536
+
+/** vector_options_t
+	Command line switches for streaming contour lines, removed from argv once parsed:
+	--vectors=FORMAT:DEST    FORMAT is geojson or svg, DEST a file, - for stdout,
+	                         or unix:/PATH to connect to a listening UNIX socket
+	--vector-tolerance=PX    Douglas-Peucker tolerance in pixels, 0 keeps every point
+**/
+typedef struct {
+	const char * spec;
+	float tolerance;
+} vector_options_t;
+
+typedef enum {
+	VECTOR_SINK_NONE,
+	VECTOR_SINK_GEOJSON,
+	VECTOR_SINK_SVG
+} vector_sink_format;
+
+/** vector_sink_t
+	Writes each frame's lines as one line of text: a GeoJSON FeatureCollection
+	of LineStrings, or an SVG document of polylines, tagged with the level
+	index and the raw depth of the level. Coordinates are image pixels.
+	A frame is formatted into the arena, allocated once at open, and written
+	in one go; lines that would overflow it are left out of that frame.
+	A socket reader that falls behind gets the rest of its frame on later
+	calls, and the frames made meanwhile are dropped; the depth thread never waits.
+**/
+typedef struct {
+	vector_sink_format format;
+	int fd;
+	int is_socket;
+	int width;
+	int height;
+	float tolerance;
+	char * arena;
+	size_t used;
+	size_t sent;
+	uint8_t * keep;			//Douglas-Peucker scratch, VECTOR_SINK_MAX_POINTS of each
+	int32_t * stack;
+	unsigned written;
+	unsigned dropped;
+	unsigned truncated;
+} vector_sink_t;
+
+void vector_parse_args(vector_options_t *, int *, char **);
+
+int vector_sink_open(vector_sink_t *, const char *, int, int, float);
+int vector_sink_write(vector_sink_t *, const isoline_set_t *, float, float, uint32_t);
+void vector_sink_close(vector_sink_t *);
@@ -0,0 +1,385 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "water.h"
+
+//level outside the grid, higher than any water gets so nothing flows out
+#define WATER_WALL 1e9f
+//a slot with this value or above has no height, as in the DEM and raw depth
+#define WATER_NO_SLOT 2047
+//no height in a height field, as BASEPLANE_NO_HEIGHT
+#define WATER_NO_HEIGHT INT16_MIN
+
+//layer value -> blend weight out of 256, deeper water hides more of the sand
+#define WATER_BLEND_BASE 96
+#define WATER_BLEND_STEP 2
+#define WATER_BLEND_MAX 224
+static const int water_rgb[3] = {20, 80, 200};
+
+//cells with a row and a cell of padding at both ends, filled with value
+static float * alloc_padded(const water_t * w, float value) {
+	int pad = w->width + 1;
+	int n = w->width * w->height + 2 * pad;
+	float * f = (float *)malloc(n * sizeof(float));
+	int i;
+
+	if(f == NULL) {
+		return NULL;
+	}
+	for(i=0;i<n;i++) {
+		f[i] = value;
+	}
+	return f + pad;
+}
+
+static void free_padded(const water_t * w, float * f) {
+	if(f != NULL) {
+		free(f - (w->width + 1));
+	}
+}
+
+//width x height cells of cell_mm, stepped on pool; returns -1 if the buffers can't be allocated
+int water_init(water_t * w, int width, int height, float cell_mm, workers_t * pool) {
+	w->width = width;
+	w->height = height;
+	w->cell_mm = cell_mm;
+	w->gravity = WATER_GRAVITY;
+	w->damping = WATER_DAMPING;
+	w->rain = 0;
+	w->evaporate = WATER_EVAPORATE_MM_S;
+	w->dt = 0;
+	w->terrain = NULL;
+	w->pool = pool;
+	w->depth = (float *)malloc(width * height * sizeof(float));
+	w->level = alloc_padded(w, WATER_WALL);
+	w->left = alloc_padded(w, 0);
+	w->right = alloc_padded(w, 0);
+	w->up = alloc_padded(w, 0);
+	w->down = alloc_padded(w, 0);
+	if(w->depth == NULL || w->level == NULL || w->left == NULL || w->right == NULL
+			|| w->up == NULL || w->down == NULL) {
+		water_free(w);
+		return -1;
+	}
+	water_clear(w);
+	return 0;
+}
+
+void water_free(water_t * w) {
+	free(w->depth);
+	free_padded(w, w->level);
+	free_padded(w, w->left);
+	free_padded(w, w->right);
+	free_padded(w, w->up);
+	free_padded(w, w->down);
+	w->depth = NULL;
+	w->level = NULL;
+	w->left = NULL;
+	w->right = NULL;
+	w->up = NULL;
+	w->down = NULL;
+}
+
+//drains everything, the padding keeps its walls
+void water_clear(water_t * w) {
+	int n = w->width * w->height;
+
+	memset(w->depth, 0, n * sizeof(float));
+	memset(w->level, 0, n * sizeof(float));
+	memset(w->left, 0, n * sizeof(float));
+	memset(w->right, 0, n * sizeof(float));
+	memset(w->up, 0, n * sizeof(float));
+	memset(w->down, 0, n * sizeof(float));
+}
+
+//first pass of a step over one tile: the flux out of every cell from the levels around it
+//only reads level and depth, which no tile writes until the second pass
+static void flux_tile(void * arg, int tile) {
+	water_t * w = (water_t *)arg;
+	int width = w->width;
+	int y0 = tile * WATER_TILE_ROWS;
+	int y1 = y0 + WATER_TILE_ROWS < w->height ? y0 + WATER_TILE_ROWS : w->height;
+	float * restrict left = w->left;
+	float * restrict right = w->right;
+	float * restrict up = w->up;
+	float * restrict down = w->down;
+	const float * restrict level = w->level;
+	const float * restrict depth = w->depth;
+	//a pipe's cross section is a cell's face, so the flux grows by g * l * (level difference) a second
+	float k = w->dt * w->gravity * w->cell_mm;
+	float keep = 1.0f - w->damping;
+	//the most that can leave a cell in a step, per mm of water
+	float room = w->cell_mm * w->cell_mm / w->dt;
+	int y, i, row, end;
+
+	//a row's ends neighbour the row before and after, not the outside, so their pipes that way
+	//are shut before the outflow is scaled, or they'd take a share of what the cell can give
+	for(y=y0;y<y1;y++) {
+		row = y * width;
+		i = row;
+		end = row + width;
+#if defined(__SSE2__)
+		{
+			__m128 v_k = _mm_set1_ps(k);
+			__m128 v_keep = _mm_set1_ps(keep);
+			__m128 v_room = _mm_set1_ps(room);
+			__m128 v_one = _mm_set1_ps(1.0f);
+			__m128 v_tiny = _mm_set1_ps(1e-12f);
+			__m128 v_zero = _mm_setzero_ps();
+			__m128 v_open_left = _mm_castsi128_ps(_mm_set_epi32(-1, -1, -1, 0));
+			__m128 v_open_right = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+			for(;i+4<=end;i+=4) {
+				__m128 lv = _mm_loadu_ps(level + i);
+				__m128 fl = _mm_max_ps(v_zero, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(left + i), v_keep),
+					_mm_mul_ps(v_k, _mm_sub_ps(lv, _mm_loadu_ps(level + i - 1)))));
+				__m128 fr = _mm_max_ps(v_zero, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(right + i), v_keep),
+					_mm_mul_ps(v_k, _mm_sub_ps(lv, _mm_loadu_ps(level + i + 1)))));
+				__m128 fu = _mm_max_ps(v_zero, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(up + i), v_keep),
+					_mm_mul_ps(v_k, _mm_sub_ps(lv, _mm_loadu_ps(level + i - width)))));
+				__m128 fd = _mm_max_ps(v_zero, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(down + i), v_keep),
+					_mm_mul_ps(v_k, _mm_sub_ps(lv, _mm_loadu_ps(level + i + width)))));
+				__m128 out, cap, s;
+				if(i == row) {
+					fl = _mm_and_ps(fl, v_open_left);
+				}
+				if(i + 4 == end) {
+					fr = _mm_and_ps(fr, v_open_right);
+				}
+				out = _mm_add_ps(_mm_add_ps(fl, fr), _mm_add_ps(fu, fd));
+				cap = _mm_mul_ps(_mm_loadu_ps(depth + i), v_room);
+				s = _mm_min_ps(v_one, _mm_div_ps(cap, _mm_max_ps(out, v_tiny)));
+				_mm_storeu_ps(left + i, _mm_mul_ps(fl, s));
+				_mm_storeu_ps(right + i, _mm_mul_ps(fr, s));
+				_mm_storeu_ps(up + i, _mm_mul_ps(fu, s));
+				_mm_storeu_ps(down + i, _mm_mul_ps(fd, s));
+			}
+		}
+#endif
+		for(;i<end;i++) {
+			float lv = level[i];
+			float fl = left[i] * keep + k * (lv - level[i - 1]);
+			float fr = right[i] * keep + k * (lv - level[i + 1]);
+			float fu = up[i] * keep + k * (lv - level[i - width]);
+			float fd = down[i] * keep + k * (lv - level[i + width]);
+			float out, cap, s;
+			fl = fl > 0 ? fl : 0;
+			fr = fr > 0 ? fr : 0;
+			fu = fu > 0 ? fu : 0;
+			fd = fd > 0 ? fd : 0;
+			fl = i == row ? 0 : fl;
+			fr = i == end - 1 ? 0 : fr;
+			out = fl + fr + fu + fd;
+			cap = depth[i] * room;
+			s = out > cap ? cap / out : 1.0f;
+			left[i] = fl * s;
+			right[i] = fr * s;
+			up[i] = fu * s;
+			down[i] = fd * s;
+		}
+	}
+}
+
+//second pass over one tile: what flowed in less what flowed out, and the new levels
+//only reads the flux, which no tile writes until the next step's first pass
+static void depth_tile(void * arg, int tile) {
+	water_t * w = (water_t *)arg;
+	int width = w->width;
+	int y0 = tile * WATER_TILE_ROWS;
+	int y1 = y0 + WATER_TILE_ROWS < w->height ? y0 + WATER_TILE_ROWS : w->height;
+	const float * restrict left = w->left;
+	const float * restrict right = w->right;
+	const float * restrict up = w->up;
+	const float * restrict down = w->down;
+	const float * restrict terrain = w->terrain;
+	float * restrict level = w->level;
+	float * restrict depth = w->depth;
+	float per = w->dt / (w->cell_mm * w->cell_mm);
+	float fall = (w->rain - w->evaporate) * w->dt;
+	int i = y0 * width;
+	int end = y1 * width;
+
+#if defined(__SSE2__)
+	{
+		__m128 v_per = _mm_set1_ps(per);
+		__m128 v_fall = _mm_set1_ps(fall);
+		__m128 v_zero = _mm_setzero_ps();
+		for(;i+4<=end;i+=4) {
+			__m128 in = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(right + i - 1), _mm_loadu_ps(left + i + 1)),
+				_mm_add_ps(_mm_loadu_ps(down + i - width), _mm_loadu_ps(up + i + width)));
+			__m128 out = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(left + i), _mm_loadu_ps(right + i)),
+				_mm_add_ps(_mm_loadu_ps(up + i), _mm_loadu_ps(down + i)));
+			__m128 d = _mm_add_ps(_mm_loadu_ps(depth + i), _mm_add_ps(_mm_mul_ps(_mm_sub_ps(in, out), v_per), v_fall));
+			d = _mm_max_ps(d, v_zero);
+			_mm_storeu_ps(depth + i, d);
+			_mm_storeu_ps(level + i, _mm_add_ps(_mm_loadu_ps(terrain + i), d));
+		}
+	}
+#endif
+	for(;i<end;i++) {
+		float in = right[i - 1] + left[i + 1] + down[i - width] + up[i + width];
+		float out = left[i] + right[i] + up[i] + down[i];
+		float d = depth[i] + (in - out) * per + fall;
+		d = d > 0 ? d : 0;
+		depth[i] = d;
+		level[i] = terrain[i] + d;
+	}
+}
+
+//advances seconds over terrain (mm, width x height) in steps, each step two passes over the pool
+void water_step(water_t * w, const float * terrain, float seconds, int steps) {
+	int tiles = (w->height + WATER_TILE_ROWS - 1) / WATER_TILE_ROWS;
+	int s;
+
+	w->terrain = terrain;
+	w->dt = seconds / steps;
+	for(s=0;s<steps;s++) {
+		workers_run_tiles(w->pool, flux_tile, w, tiles);
+		workers_run_tiles(w->pool, depth_tile, w, tiles);
+	}
+}
+
+//depths in 1/WATER_LAYER_SCALE mm, up to 255, into a width x height layer; returns the wet cells
+int water_layer(const water_t * w, uint8_t * layer) {
+	int n = w->width * w->height;
+	int wet = 0;
+	int i = 0;
+
+#if defined(__SSE2__)
+	__m128 v_scale = _mm_set1_ps((float)WATER_LAYER_SCALE);
+	for(;i+8<=n;i+=8) {
+		__m128i a = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(w->depth + i), v_scale));
+		__m128i b = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(w->depth + i + 4), v_scale));
+		__m128i v = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_setzero_si128());
+		_mm_storel_epi64((__m128i *)(layer + i), v);
+	}
+#endif
+	for(;i<n;i++) {
+		float v = w->depth[i] * WATER_LAYER_SCALE;
+		layer[i] = v >= 255.0f ? 255 : (uint8_t)v;
+	}
+	for(i=0;i<n;i++) {
+		wet += layer[i] != 0;
+	}
+	return wet;
+}
+
+//terrain for the grid from a frame of slots width wide, each cell the mean height of the slots over it
+//table: slot -> height in mm; cells with nothing but slots from WATER_NO_SLOT on keep their old height
+void water_terrain_slots(const water_t * w, const uint16_t * slots, int width, const float * table, float * terrain) {
+	int scale = width / w->width;
+	int x, y, dx, dy;
+
+	for(y=0;y<w->height;y++) {
+		for(x=0;x<w->width;x++) {
+			const uint16_t * s = slots + y * scale * width + x * scale;
+			float sum = 0;
+			int count = 0;
+			for(dy=0;dy<scale;dy++) {
+				for(dx=0;dx<scale;dx++) {
+					uint16_t v = s[dy * width + dx];
+					if(v < WATER_NO_SLOT) {
+						sum += table[v];
+						count++;
+					}
+				}
+			}
+			if(count) {
+				terrain[y * w->width + x] = sum / count;
+			}
+		}
+	}
+}
+
+//the same from heights in mm, WATER_NO_HEIGHT for none
+void water_terrain_heights(const water_t * w, const int16_t * heights, int width, float * terrain) {
+	int scale = width / w->width;
+	int x, y, dx, dy;
+
+	for(y=0;y<w->height;y++) {
+		for(x=0;x<w->width;x++) {
+			const int16_t * h = heights + y * scale * width + x * scale;
+			int sum = 0;
+			int count = 0;
+			for(dy=0;dy<scale;dy++) {
+				for(dx=0;dx<scale;dx++) {
+					int16_t v = h[dy * width + dx];
+					if(v != WATER_NO_HEIGHT) {
+						sum += v;
+						count++;
+					}
+				}
+			}
+			if(count) {
+				terrain[y * w->width + x] = (float)sum / count;
+			}
+		}
+	}
+}
+
+//1 if the layer has any water in it
+int water_wet(const water_t * w, const uint8_t * layer) {
+	int n = w->width * w->height;
+	int i;
+
+	for(i=0;i<n;i++) {
+		if(layer[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//blends the layer's water over an rgb frame width x height, a whole number of pixels to the cell
+void water_blend(const water_t * w, const uint8_t * layer, uint8_t * rgb, int width, int height) {
+	int scale = width / w->width;
+	int x, y, dx, dy, c;
+
+	for(y=0;y<w->height && y * scale < height;y++) {
+		for(x=0;x<w->width;x++) {
+			int v = layer[y * w->width + x];
+			int a;
+			if(!v) {
+				continue;
+			}
+			a = WATER_BLEND_BASE + v * WATER_BLEND_STEP;
+			a = a > WATER_BLEND_MAX ? WATER_BLEND_MAX : a;
+			for(dy=0;dy<scale;dy++) {
+				uint8_t * p = rgb + 3 * ((y * scale + dy) * width + x * scale);
+				for(dx=0;dx<scale;dx++, p+=3) {
+					for(c=0;c<3;c++) {
+						p[c] = (uint8_t)(p[c] + (((water_rgb[c] - p[c]) * a) >> 8));
+					}
+				}
+			}
+		}
+	}
+}
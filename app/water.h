@@ -0,0 +1,86 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "workers.h"
+
+#define WATER_X 320
+#define WATER_Y 240
+#define WATER_HZ 60				//simulation ticks a second, whatever the camera's frame rate
+#define WATER_SUBSTEPS 4		//solver steps per tick, keeps waves under a cell a step
+#define WATER_CELL_MM 4.0f		//about a 640x480 view of a sandbox, two pixels to the cell
+#define WATER_GRAVITY 9810.0f	//mm/s^2
+#define WATER_DAMPING 0.02f		//flux lost per step, lets ripples settle
+#define WATER_RAIN_MM_S 2.0f
+#define WATER_EVAPORATE_MM_S 0.05f
+#define WATER_LAYER_SCALE 4		//layer units per mm of water
+#define WATER_TILE_ROWS 8		//rows per scheduled tile
+
+/** water_t
+	Shallow water over the sand, as virtual pipes between neighbouring cells.
+	Each step, the flux out of a cell through each pipe grows with the
+	difference in water level (terrain plus water) across it, and is scaled
+	down where it would drain more than the cell holds; the water then moves
+	by what flows in less what flows out. Edges are walls.
+	Rows are cut into tiles of WATER_TILE_ROWS that the pool works through,
+	each pass is four cells at a time where SSE2 is there.
+	All heights are in mm. The flux arrays and level are padded by a row and a
+	cell at both ends, so neighbours outside the grid read as walls.
+	terrain: the step's ground, owned by the caller
+	level: terrain + depth as of the last step
+	left/right/up/down: flux out of each cell through that side, mm^3/s
+**/
+typedef struct {
+	int width;
+	int height;
+	float cell_mm;
+	float gravity;
+	float damping;
+	float rain;			//mm/s falling everywhere
+	float evaporate;	//mm/s lost everywhere there is water
+	float dt;
+	const float * terrain;
+	float * depth;
+	float * level;
+	float * left;
+	float * right;
+	float * up;
+	float * down;
+	workers_t * pool;
+} water_t;
+
+int water_init(water_t *, int, int, float, workers_t *);
+void water_free(water_t *);
+void water_clear(water_t *);
+void water_step(water_t *, const float *, float, int);
+int water_layer(const water_t *, uint8_t *);
+void water_terrain_slots(const water_t *, const uint16_t *, int, const float *, float *);
+void water_terrain_heights(const water_t *, const int16_t *, int, float *);
+int water_wet(const water_t *, const uint8_t *);
+void water_blend(const water_t *, const uint8_t *, uint8_t *, int, int);
@@ -0,0 +1,228 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "workers.h"
+
+#define WORKERS_CAP 8
+
+typedef struct {
+	workers_t * pool;
+	int index;
+} worker_slot_t;
+
+/** tile_job_t
+	One workers_run_tiles call. Each worker's share of the tiles is [next, end),
+	packed into one word as end << 32 | next, so the owner taking from the
+	front and a thief taking from the back are each a single compare-and-swap.
+**/
+typedef struct {
+	workers_tile_fn fn;
+	void * arg;
+	_Atomic uint64_t shares[WORKERS_CAP];
+} tile_job_t;
+
+//one worker per online cpu, capped
+int workers_default_count() {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n < 1) {
+		return 1;
+	}
+	return n > WORKERS_CAP ? WORKERS_CAP : (int)n;
+}
+
+static void * worker_main(void * arg) {
+	worker_slot_t * slot = (worker_slot_t *)arg;
+	workers_t * w = slot->pool;
+	int index = slot->index;
+	unsigned seen = 0;
+
+	free(slot);
+	pthread_mutex_lock(&w->lock);
+	while(1) {
+		while(!w->quit && w->generation == seen) {
+			pthread_cond_wait(&w->start, &w->lock);
+		}
+		if(w->quit) {
+			break;
+		}
+		seen = w->generation;
+		pthread_mutex_unlock(&w->lock);
+
+		w->fn(w->arg, index, w->count);
+
+		pthread_mutex_lock(&w->lock);
+		if(--w->pending == 0) {
+			pthread_cond_signal(&w->done);
+		}
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+//starts count-1 threads, returns 0 on success
+int workers_init(workers_t * w, int count) {
+	int i;
+
+	w->count = count < 1 ? 1 : (count > WORKERS_CAP ? WORKERS_CAP : count);
+	w->fn = NULL;
+	w->arg = NULL;
+	w->generation = 0;
+	w->pending = 0;
+	w->quit = 0;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->start, NULL);
+	pthread_cond_init(&w->done, NULL);
+	w->threads = (pthread_t *)calloc(w->count, sizeof(pthread_t));
+	if(w->threads == NULL) {
+		return -1;
+	}
+	for(i=1;i<w->count;i++) {
+		worker_slot_t * slot = (worker_slot_t *)malloc(sizeof(worker_slot_t));
+		if(slot == NULL) {
+			w->count = i;
+			workers_free(w);
+			return -1;
+		}
+		slot->pool = w;
+		slot->index = i;
+		if(pthread_create(&w->threads[i], NULL, worker_main, slot) != 0) {
+			free(slot);
+			w->count = i;
+			workers_free(w);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void workers_free(workers_t * w) {
+	int i;
+	if(w->threads == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&w->lock);
+	w->quit = 1;
+	pthread_cond_broadcast(&w->start);
+	pthread_mutex_unlock(&w->lock);
+	for(i=1;i<w->count;i++) {
+		pthread_join(w->threads[i], NULL);
+	}
+	free(w->threads);
+	w->threads = NULL;
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->start);
+	pthread_cond_destroy(&w->done);
+}
+
+//runs fn(arg, index, count) on every worker and returns once they have all finished
+void workers_run(workers_t * w, workers_fn fn, void * arg) {
+	pthread_mutex_lock(&w->lock);
+	w->fn = fn;
+	w->arg = arg;
+	w->pending = w->count - 1;
+	w->generation++;
+	pthread_cond_broadcast(&w->start);
+	pthread_mutex_unlock(&w->lock);
+
+	fn(arg, 0, w->count);
+
+	pthread_mutex_lock(&w->lock);
+	while(w->pending > 0) {
+		pthread_cond_wait(&w->done, &w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+//takes the first tile of a share, returns 0 once it is empty
+static int take_front(_Atomic uint64_t * share, int * tile) {
+	uint64_t old = atomic_load(share);
+	uint32_t next, end;
+
+	do {
+		next = (uint32_t)old;
+		end = (uint32_t)(old >> 32);
+		if(next >= end) {
+			return 0;
+		}
+	} while(!atomic_compare_exchange_weak(share, &old, ((uint64_t)end << 32) | (next + 1)));
+	*tile = next;
+	return 1;
+}
+
+//takes the last tile of someone else's share, returns 0 once it is empty
+static int take_back(_Atomic uint64_t * share, int * tile) {
+	uint64_t old = atomic_load(share);
+	uint32_t next, end;
+
+	do {
+		next = (uint32_t)old;
+		end = (uint32_t)(old >> 32);
+		if(next >= end) {
+			return 0;
+		}
+	} while(!atomic_compare_exchange_weak(share, &old, ((uint64_t)(end - 1) << 32) | next));
+	*tile = end - 1;
+	return 1;
+}
+
+//works through its own share front to back, then steals from the back of the others'
+static void tile_worker(void * arg, int index, int count) {
+	tile_job_t * job = (tile_job_t *)arg;
+	int tile;
+	int v;
+
+	while(take_front(&job->shares[index], &tile)) {
+		job->fn(job->arg, tile);
+	}
+	for(v=1;v<count;v++) {
+		_Atomic uint64_t * victim = &job->shares[(index + v) % count];
+		while(take_back(victim, &tile)) {
+			job->fn(job->arg, tile);
+		}
+	}
+}
+
+//runs fn(arg, tile) for tiles 0 to tiles-1 across the pool and returns once all are done
+//every worker starts on a run of neighbouring tiles, whoever finishes first helps the slowest,
+//so uneven tiles or a descheduled thread don't hold up the whole job
+void workers_run_tiles(workers_t * w, workers_tile_fn fn, void * arg, int tiles) {
+	tile_job_t job;
+	int i;
+
+	job.fn = fn;
+	job.arg = arg;
+	for(i=0;i<w->count;i++) {
+		uint64_t next = (uint64_t)tiles * i / w->count;
+		uint64_t end = (uint64_t)tiles * (i + 1) / w->count;
+		atomic_init(&job.shares[i], (end << 32) | next);
+	}
+	workers_run(w, tile_worker, &job);
+}
@@ -0,0 +1,55 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2010 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+#pragma once
+
+#include <pthread.h>
+
+typedef void (*workers_fn)(void *, int, int);
+typedef void (*workers_tile_fn)(void *, int);
+
+/** workers_t
+	A fixed pool of threads that run one job at a time, each worker getting
+	its index and the worker count so it can pick its own share of the frame.
+	The calling thread takes part as worker 0.
+**/
+typedef struct {
+	int count;
+	pthread_t * threads;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	workers_fn fn;
+	void * arg;
+	unsigned generation;	//bumped for every job so sleeping workers know a new one arrived
+	int pending;			//workers still busy with the current job
+	int quit;
+} workers_t;
+
+int workers_default_count();
+int workers_init(workers_t *, int);
+void workers_free(workers_t *);
+void workers_run(workers_t *, workers_fn, void *);
+void workers_run_tiles(workers_t *, workers_tile_fn, void *, int);
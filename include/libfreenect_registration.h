@@ -107,8 +107,35 @@ typedef struct {
 	int32_t* depth_to_rgb_shift;
 	int32_t (*registration_table)[2];  // A table of 640*480 pairs of x,y values.
 	                                   // Index first by pixel, then x:0 and y:1.
+
+	int32_t (*registration_table_high)[2]; // As registration_table, but into the
+	                                       // 1280x1024 video frame. Built on first use.
+
+	float* ray_x; // 640 per-column x/z ratios for depth -> world, built on first use
+	float* ray_y; // 480 per-row y/z ratios for depth -> world, built on first use
 } freenect_registration;
 
+/// Output layouts for freenect_depth_to_points().
+/// FREENECT_POINTS_COMPACT and FREENECT_POINTS_GRAVITY may be or'ed onto any layout.
+typedef enum {
+	FREENECT_POINTS_XYZ_FLOAT = 0x000, /**< packed float32 x,y,z in mm, 12 bytes per point */
+	FREENECT_POINTS_XYZ_MM    = 0x001, /**< packed int16_t x,y,z in mm, 6 bytes per point */
+	FREENECT_POINTS_XYZRGB    = 0x002, /**< interleaved freenect_point_xyzrgb, 16 bytes per point */
+	FREENECT_POINTS_XYZ_RGB   = 0x003, /**< planar: float32 x,y,z array, then uint8_t r,g,b array at byte offset FREENECT_POINTS_RGB_OFFSET */
+	FREENECT_POINTS_COMPACT   = 0x100, /**< skip pixels without depth rather than writing 0,0,0 */
+	FREENECT_POINTS_GRAVITY   = 0x200, /**< rotate into a gravity aligned frame, see freenect_depth_to_points */
+} freenect_point_format;
+
+/// Byte offset of the colour array within a FREENECT_POINTS_XYZ_RGB buffer
+#define FREENECT_POINTS_RGB_OFFSET (640*480*3*sizeof(float))
+
+/// One point of FREENECT_POINTS_XYZRGB output
+typedef struct {
+	float x, y, z;    // world coordinates in mm
+	uint8_t r, g, b;
+	uint8_t valid;    // 255 if a video pixel was found for this point, 0 otherwise
+} freenect_point_xyzrgb;
+
 
 // These allow clients to export registration parameters; proper docs will
 // come later
@@ -120,6 +147,51 @@ FREENECTAPI int freenect_destroy_registration(freenect_registration* reg);
 FREENECTAPI void freenect_camera_to_world(freenect_device* dev,
 	int cx, int cy, int wz, double* wx, double* wy);
 
+// convert a whole 640x480 FREENECT_DEPTH_MM frame to world coordinates, using
+// the same model as freenect_camera_to_world. out must hold 640*480 points of
+// the requested layout. With FREENECT_POINTS_GRAVITY the points are rotated so
+// that gravity lies along +y (Kinect looking ahead) or +z (looking down),
+// using a low-pass filtered accelerometer estimate that is updated by every
+// freenect_update_tilt_state call; until the first such call the points are
+// left unrotated. Returns the number of points written, < 0 on error.
+FREENECTAPI int freenect_depth_to_points(freenect_device* dev,
+	const uint16_t* depth_mm, void* out, int fmt);
+
+// convert a FREENECT_DEPTH_11BIT_PACKED frame straight to a coloured point
+// cloud in one pass, sampling a 640x480 FREENECT_VIDEO_RGB frame through the
+// registration tables. fmt is FREENECT_POINTS_XYZRGB or FREENECT_POINTS_XYZ_RGB,
+// optionally or'ed with FREENECT_POINTS_COMPACT. Timestamps are those handed
+// to the depth and video callbacks; if max_skew is nonzero and the two frames
+// are further apart than that, nothing is written and -2 is returned.
+// FREENECT_POINTS_GRAVITY works as for freenect_depth_to_points. Otherwise
+// returns the number of points written, or -1 on error.
+FREENECTAPI int freenect_depth_to_colored_points(freenect_device* dev,
+	const uint8_t* depth_packed, uint32_t depth_timestamp,
+	const uint8_t* video_rgb, uint32_t video_timestamp,
+	uint32_t max_skew, void* out, int fmt);
+
+// compute organized per-pixel surface normals, slope and aspect from a
+// FREENECT_DEPTH_MM frame, by central differences of the world positions
+// (one-sided next to pixels without depth). normals holds 640*480 unit x,y,z
+// triples pointing towards the camera; slope is the angle in radians between
+// the normal and the optical axis; aspect is the direction the surface faces
+// in the image plane, atan2(ny, nx). Any output may be NULL. Pixels without a
+// usable neighbourhood get a 0,0,0 normal, a slope of -1 and an aspect of 0.
+// Only rows [row_begin, row_end) are written, so a frame can be split into
+// bands across threads; the ray tables are built on the first call, so make
+// that one (an empty band will do) before starting the threads.
+// Returns 0 on success, < 0 on error.
+FREENECTAPI int freenect_depth_to_normals(freenect_device* dev,
+	const uint16_t* depth_mm, float* normals, float* slope, float* aspect,
+	int row_begin, int row_end);
+
+// FREENECT_DEPTH_REGISTERED for FREENECT_RESOLUTION_HIGH video: map a
+// 640x480 FREENECT_DEPTH_MM frame into the 1280x1024 video frame, writing
+// 1280*1024 uint16_t mm values to output_mm. Only available while a HIGH
+// resolution video mode is set. Returns 0 on success, < 0 on error.
+FREENECTAPI int freenect_map_depth_to_rgb_high(freenect_device* dev,
+	const uint16_t* depth_mm, uint16_t* output_mm);
+
 // helper function to map one FREENECT_VIDEO_RGB image to a FREENECT_DEPTH_MM
 // image (inverse mapping to FREENECT_DEPTH_REGISTERED, which is depth -> RGB)
 FREENECTAPI void freenect_map_rgb_to_depth( freenect_device* dev,
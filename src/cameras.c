@@ -1177,6 +1177,10 @@ int freenect_set_video_mode(freenect_device* dev, const freenect_frame_mode mode
 	// Now that we've changed video format and resolution, we need to update
 	// registration tables.
 	freenect_fetch_reg_info(dev);
+	if (dev->registration.registration_table_high) {
+		free(dev->registration.registration_table_high);
+		dev->registration.registration_table_high = NULL;
+	}
 	return 0;
 }
 
@@ -238,6 +238,11 @@ struct _freenect_device {
 	// Registration
 	freenect_registration registration;
 
+	// Gravity alignment for FREENECT_POINTS_GRAVITY, fed by freenect_update_tilt_state
+	int gravity_valid;
+	double gravity[3];             // low-pass filtered unit "down" vector, camera axes
+	float gravity_rotation[3][3];  // camera -> gravity aligned frame
+
 	// Audio
 	fnusb_dev usb_audio;
 	fnusb_isoc_stream audio_out_isoc;
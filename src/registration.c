@@ -31,7 +31,11 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <float.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define REG_X_VAL_SCALE 256 // "fixed-point" precision for double -> int32_t conversion
 
@@ -51,6 +55,12 @@
 #define DEPTH_X_RES 640
 #define DEPTH_Y_RES 480
 
+// FREENECT_RESOLUTION_HIGH video; the VGA image is this one cropped to
+// 1280x960 and halved, so VGA coordinates map over by a factor of two
+#define VIDEO_HIGH_X_RES 1280
+#define VIDEO_HIGH_Y_RES 1024
+#define VIDEO_HIGH_SCALE 2
+
 // try to fill single empty pixels AKA "salt-and-pepper noise"
 // disabled by default, noise removal better handled in later stages
 // #define DENSE_REGISTRATION
@@ -74,7 +84,7 @@ static void freenect_init_depth_to_rgb(int32_t* depth_to_rgb, freenect_zero_plan
 }
 
 // unrolled inner loop of the 11-bit unpacker
-static inline void unpack_8_pixels(uint8_t *raw, uint16_t *frame)
+static inline void unpack_8_pixels(const uint8_t *raw, uint16_t *frame)
 {
 	uint16_t baseMask = 0x7FF;
 
@@ -261,7 +271,9 @@ static void freenect_create_dxdy_tables(double* reg_x_table, double* reg_y_table
 	}
 }
 
-static void freenect_init_registration_table(int32_t (*registration_table)[2], freenect_reg_info* reg_info) {
+// scale is 1 for a table into the VGA video frame, VIDEO_HIGH_SCALE for the
+// 1280x1024 one; x is always stored in REG_X_VAL_SCALE fixed point
+static void freenect_init_registration_table(int32_t (*registration_table)[2], freenect_reg_info* reg_info, int32_t scale) {
 
 	double* regtable_dx = (double*)malloc(DEPTH_X_RES*DEPTH_Y_RES*sizeof(double));
 	double* regtable_dy = (double*)malloc(DEPTH_X_RES*DEPTH_Y_RES*sizeof(double));
@@ -278,10 +290,10 @@ static void freenect_init_registration_table(int32_t (*registration_table)[2], f
 			double new_y = y + regtable_dy[index] + DEPTH_Y_OFFSET;
 
 			if ((new_x < 0) || (new_y < 0) || (new_x >= DEPTH_X_RES) || (new_y >= DEPTH_Y_RES))
-				new_x = 2 * DEPTH_X_RES; // intentionally set value outside image bounds
+				new_x = 2 * VIDEO_HIGH_X_RES; // intentionally set value outside image bounds
 
-			registration_table[index][0] = new_x * REG_X_VAL_SCALE;
-			registration_table[index][1] = new_y;
+			registration_table[index][0] = new_x * scale * REG_X_VAL_SCALE;
+			registration_table[index][1] = new_y * scale;
 		}
 	}
 	free(regtable_dx);
@@ -311,7 +323,7 @@ static void complete_tables(freenect_registration* reg) {
 
 	freenect_init_depth_to_rgb( reg->depth_to_rgb_shift, &(reg->zero_plane_info) );
 
-	freenect_init_registration_table( reg->registration_table, &(reg->reg_info) );
+	freenect_init_registration_table( reg->registration_table, &(reg->reg_info), 1 );
 }
 
 /// camera -> world coordinate helper function
@@ -329,6 +341,475 @@ void freenect_camera_to_world(freenect_device* dev, int cx, int cy, int wz, doub
 	*wy = (double)(cy - DEPTH_Y_RES/2) * factor;
 }
 
+#define GRAVITY_FILTER_ALPHA 0.2 // weight of each new accelerometer sample in the gravity estimate
+
+/// Fold the latest accelerometer reading into the low-pass filtered gravity
+/// estimate and rebuild the rotation used by FREENECT_POINTS_GRAVITY. Called
+/// by freenect_update_tilt_state, on whatever thread the application polls
+/// the motor from.
+FN_INTERNAL void freenect_update_gravity(freenect_device* dev)
+{
+	freenect_raw_tilt_state* state = &(dev->raw_state);
+	// The accelerometer axes line up with the depth camera's (x right, y down,
+	// z forward); a level Kinect reads about +1g along y.
+	double g[3] = { state->accelerometer_x, state->accelerometer_y, state->accelerometer_z };
+	double norm = sqrt(g[0]*g[0] + g[1]*g[1] + g[2]*g[2]);
+	int i;
+
+	// ignore readings far from 1g (no data yet, or the mount is being moved)
+	if (norm < 0.5 * FREENECT_COUNTS_PER_G || norm > 1.5 * FREENECT_COUNTS_PER_G)
+		return;
+
+	for (i = 0; i < 3; i++) {
+		g[i] /= norm;
+		dev->gravity[i] = dev->gravity_valid ? dev->gravity[i] + GRAVITY_FILTER_ALPHA * (g[i] - dev->gravity[i]) : g[i];
+	}
+	norm = sqrt(dev->gravity[0]*dev->gravity[0] + dev->gravity[1]*dev->gravity[1] + dev->gravity[2]*dev->gravity[2]);
+	for (i = 0; i < 3; i++)
+		g[i] = dev->gravity[i] / norm;
+
+	// Rotate gravity onto whichever camera axis is closest to it: +y for a
+	// Kinect looking ahead, +z for one looking down at a table. Smallest
+	// rotation taking g to e (Rodrigues): R = I + [v]x + [v]x^2 / (1 + c),
+	// with v = g x e and c = g . e.
+	double e[3] = { 0, g[1] >= g[2], g[1] < g[2] };
+	double v[3] = { g[1]*e[2] - g[2]*e[1], g[2]*e[0] - g[0]*e[2], g[0]*e[1] - g[1]*e[0] };
+	double c = g[0]*e[0] + g[1]*e[1] + g[2]*e[2];
+	double vx[3][3] = { {0, -v[2], v[1]}, {v[2], 0, -v[0]}, {-v[1], v[0], 0} };
+	int j,k;
+
+	if (c < -0.99) // upside down; no well defined smallest rotation
+		return;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			double vx2 = 0;
+			for (k = 0; k < 3; k++)
+				vx2 += vx[i][k] * vx[k][j];
+			dev->gravity_rotation[i][j] = (i == j) + vx[i][j] + vx2 / (1 + c);
+		}
+	}
+	dev->gravity_valid = 1;
+}
+
+/// Fill the per-column and per-row ray tables used by freenect_depth_to_points.
+/// World x,y are linear in depth along each ray, so a pixel's world position
+/// is simply (ray_x[x] * z, ray_y[y] * z, z).
+static int freenect_init_ray_tables(freenect_registration* reg)
+{
+	double ref_pix_size = reg->zero_plane_info.reference_pixel_size;
+	double ref_distance = reg->zero_plane_info.reference_distance;
+	double factor = 2 * ref_pix_size / ref_distance; // see freenect_camera_to_world
+	int i;
+
+	if (ref_distance <= 0)
+		return -1;
+
+	reg->ray_x = (float*)malloc(sizeof(float) * DEPTH_X_RES);
+	reg->ray_y = (float*)malloc(sizeof(float) * DEPTH_Y_RES);
+	if (!reg->ray_x || !reg->ray_y) {
+		free(reg->ray_x);
+		free(reg->ray_y);
+		reg->ray_x = reg->ray_y = NULL;
+		return -1;
+	}
+
+	for (i = 0; i < DEPTH_X_RES; i++)
+		reg->ray_x[i] = (i - DEPTH_X_RES/2) * factor;
+	for (i = 0; i < DEPTH_Y_RES; i++)
+		reg->ray_y[i] = (i - DEPTH_Y_RES/2) * factor;
+	return 0;
+}
+
+/// Per-frame ray terms: the world position of pixel (x,y) at depth z is
+/// z * (col[i][x] + row[i][y]) along each axis i. Unaligned that is just
+/// (ray_x[x], ray_y[y], 1); with FREENECT_POINTS_GRAVITY the rotation is folded
+/// into these terms once per frame rather than applied once per pixel.
+typedef struct {
+	float col[3][DEPTH_X_RES];
+	float row[3][DEPTH_Y_RES];
+} world_rays;
+
+static void freenect_init_world_rays(freenect_device* dev, int gravity_align, world_rays* rays)
+{
+	freenect_registration* reg = &(dev->registration);
+	float R[3][3] = { {1,0,0}, {0,1,0}, {0,0,1} };
+	int i,j;
+
+	// may race with freenect_update_tilt_state; a torn read mixes two nearly
+	// identical filtered estimates, which is harmless
+	if (gravity_align && dev->gravity_valid)
+		memcpy(R, dev->gravity_rotation, sizeof(R));
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < DEPTH_X_RES; j++)
+			rays->col[i][j] = R[i][0] * reg->ray_x[j];
+		for (j = 0; j < DEPTH_Y_RES; j++)
+			rays->row[i][j] = R[i][1] * reg->ray_y[j] + R[i][2];
+	}
+}
+
+static inline int16_t round_to_mm(float v)
+{
+	return (int16_t)(v + (v < 0 ? -0.5f : 0.5f));
+}
+
+// one row of packed float xyz, four pixels per step
+static inline void depth_row_to_float(const uint16_t* depth, const world_rays* rays, int y, float* out)
+{
+	const float* cx = rays->col[0];
+	const float* cy = rays->col[1];
+	const float* cz = rays->col[2];
+	float bx = rays->row[0][y], by = rays->row[1][y], bz = rays->row[2][y];
+	int x = 0;
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 BX = _mm_set1_ps(bx), BY = _mm_set1_ps(by), BZ = _mm_set1_ps(bz);
+	for (; x < DEPTH_X_RES; x += 4, out += 12) {
+		__m128i d = _mm_loadl_epi64((const __m128i*)(depth + x));
+		__m128 D = _mm_cvtepi32_ps(_mm_unpacklo_epi16(d, zero));
+		__m128 X = _mm_mul_ps(D, _mm_add_ps(_mm_loadu_ps(cx + x), BX));
+		__m128 Y = _mm_mul_ps(D, _mm_add_ps(_mm_loadu_ps(cy + x), BY));
+		__m128 Z = _mm_mul_ps(D, _mm_add_ps(_mm_loadu_ps(cz + x), BZ));
+
+		// transpose x0..x3, y0..y3, z0..z3 into x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+		__m128 xy_lo = _mm_unpacklo_ps(X, Y);
+		__m128 xy_hi = _mm_unpackhi_ps(X, Y);
+		__m128 z0x1  = _mm_shuffle_ps(Z, X, _MM_SHUFFLE(1,1,0,0));
+		__m128 y1z1  = _mm_shuffle_ps(Y, Z, _MM_SHUFFLE(1,1,1,1));
+		__m128 x3z2  = _mm_shuffle_ps(xy_hi, Z, _MM_SHUFFLE(3,2,3,2));
+		_mm_storeu_ps(out + 0, _mm_shuffle_ps(xy_lo, z0x1, _MM_SHUFFLE(2,0,1,0)));
+		_mm_storeu_ps(out + 4, _mm_shuffle_ps(y1z1, xy_hi, _MM_SHUFFLE(1,0,2,0)));
+		_mm_storeu_ps(out + 8, _mm_shuffle_ps(x3z2, x3z2, _MM_SHUFFLE(3,1,0,2)));
+	}
+#endif
+	for (; x < DEPTH_X_RES; x++, out += 3) {
+		float z = depth[x];
+		out[0] = (cx[x] + bx) * z;
+		out[1] = (cy[x] + by) * z;
+		out[2] = (cz[x] + bz) * z;
+	}
+}
+
+// one row of packed int16 xyz (mm), rounded to nearest
+static inline void depth_row_to_mm(const uint16_t* depth, const world_rays* rays, int y, int16_t* out)
+{
+	const float* cx = rays->col[0];
+	const float* cy = rays->col[1];
+	const float* cz = rays->col[2];
+	float bx = rays->row[0][y], by = rays->row[1][y], bz = rays->row[2][y];
+	int x;
+	for (x = 0; x < DEPTH_X_RES; x++, out += 3) {
+		float z = depth[x];
+		out[0] = round_to_mm((cx[x] + bx) * z);
+		out[1] = round_to_mm((cy[x] + by) * z);
+		out[2] = round_to_mm((cz[x] + bz) * z);
+	}
+}
+
+/// depth frame -> point cloud
+int freenect_depth_to_points(freenect_device* dev, const uint16_t* depth_mm, void* out, int fmt)
+{
+	freenect_registration* reg = &(dev->registration);
+	int compact = fmt & FREENECT_POINTS_COMPACT;
+	int layout = fmt & ~(FREENECT_POINTS_COMPACT | FREENECT_POINTS_GRAVITY);
+	world_rays rays;
+	uint32_t x,y,n = 0;
+
+	if (layout != FREENECT_POINTS_XYZ_FLOAT && layout != FREENECT_POINTS_XYZ_MM)
+		return -1;
+	if (!reg->ray_x && freenect_init_ray_tables(reg) < 0)
+		return -1;
+	freenect_init_world_rays(dev, fmt & FREENECT_POINTS_GRAVITY, &rays);
+
+	if (!compact) {
+		// dense output keeps the 640x480 organization, invalid pixels come out as 0,0,0
+		for (y = 0; y < DEPTH_Y_RES; y++) {
+			const uint16_t* row = depth_mm + y * DEPTH_X_RES;
+			if (layout == FREENECT_POINTS_XYZ_FLOAT)
+				depth_row_to_float(row, &rays, y, (float*)out + y * DEPTH_X_RES * 3);
+			else
+				depth_row_to_mm(row, &rays, y, (int16_t*)out + y * DEPTH_X_RES * 3);
+		}
+		return DEPTH_X_RES * DEPTH_Y_RES;
+	}
+
+	// compacted output: always store, only advance past valid pixels (no branch on the data)
+	for (y = 0; y < DEPTH_Y_RES; y++) {
+		const uint16_t* row = depth_mm + y * DEPTH_X_RES;
+		float bx = rays.row[0][y], by = rays.row[1][y], bz = rays.row[2][y];
+		for (x = 0; x < DEPTH_X_RES; x++) {
+			float z = row[x];
+			float wx = (rays.col[0][x] + bx) * z;
+			float wy = (rays.col[1][x] + by) * z;
+			float wz = (rays.col[2][x] + bz) * z;
+			if (layout == FREENECT_POINTS_XYZ_FLOAT) {
+				float* p = (float*)out + 3 * n;
+				p[0] = wx;
+				p[1] = wy;
+				p[2] = wz;
+			} else {
+				int16_t* p = (int16_t*)out + 3 * n;
+				p[0] = round_to_mm(wx);
+				p[1] = round_to_mm(wy);
+				p[2] = round_to_mm(wz);
+			}
+			n += (row[x] != DEPTH_NO_MM_VALUE);
+		}
+	}
+	return n;
+}
+
+/// packed depth + RGB frame -> coloured point cloud
+int freenect_depth_to_colored_points(freenect_device* dev,
+	const uint8_t* depth_packed, uint32_t depth_timestamp,
+	const uint8_t* video_rgb, uint32_t video_timestamp,
+	uint32_t max_skew, void* out, int fmt)
+{
+	freenect_registration* reg = &(dev->registration);
+	int compact = fmt & FREENECT_POINTS_COMPACT;
+	int layout = fmt & ~(FREENECT_POINTS_COMPACT | FREENECT_POINTS_GRAVITY);
+	world_rays rays;
+
+	if (layout != FREENECT_POINTS_XYZRGB && layout != FREENECT_POINTS_XYZ_RGB)
+		return -1;
+
+	// timestamps wrap, so compare the signed difference
+	int32_t skew = (int32_t)(depth_timestamp - video_timestamp);
+	if (max_skew && (uint32_t)(skew < 0 ? -skew : skew) > max_skew)
+		return -2;
+
+	// the registration tables only exist while a REGISTERED or MM stream runs
+	if (!reg->raw_to_mm_shift && freenect_init_registration(dev) < 0)
+		return -1;
+	if (!reg->ray_x && freenect_init_ray_tables(reg) < 0)
+		return -1;
+	freenect_init_world_rays(dev, fmt & FREENECT_POINTS_GRAVITY, &rays);
+
+	freenect_point_xyzrgb* interleaved = (freenect_point_xyzrgb*)out;
+	float* xyz = (float*)out;
+	uint8_t* rgb = (uint8_t*)out + FREENECT_POINTS_RGB_OFFSET;
+
+	uint32_t target_offset = DEPTH_Y_RES * reg->reg_pad_info.start_lines;
+	uint16_t unpack[8];
+	uint32_t x,y,n = 0,source_index = 8,index = 0;
+
+	for (y = 0; y < DEPTH_Y_RES; y++) {
+		float bx = rays.row[0][y], by = rays.row[1][y], bz = rays.row[2][y];
+		for (x = 0; x < DEPTH_X_RES; x++, index++) {
+			if (source_index == 8) {
+				unpack_8_pixels( depth_packed, unpack );
+				source_index = 0;
+				depth_packed += 11;
+			}
+
+			uint16_t metric_depth = reg->raw_to_mm_shift[ unpack[source_index++] ];
+			if (metric_depth >= DEPTH_MAX_METRIC_VALUE)
+				metric_depth = DEPTH_NO_MM_VALUE;
+			if (compact && metric_depth == DEPTH_NO_MM_VALUE)
+				continue;
+
+			// same lookup as freenect_apply_registration, but gathering colour
+			// instead of scattering depth
+			const uint8_t* colour = NULL;
+			if (metric_depth != DEPTH_NO_MM_VALUE) {
+				uint32_t reg_index = DEPTH_MIRROR_X ? ((y + 1) * DEPTH_X_RES - x - 1) : index;
+				uint32_t nx = (reg->registration_table[reg_index][0] + reg->depth_to_rgb_shift[metric_depth]) / REG_X_VAL_SCALE;
+				uint32_t ny =  reg->registration_table[reg_index][1];
+				uint32_t video_index = (DEPTH_MIRROR_X ? ((ny + 1) * DEPTH_X_RES - nx - 1) : (ny * DEPTH_X_RES + nx)) - target_offset;
+				if (nx < DEPTH_X_RES && video_index < DEPTH_X_RES * DEPTH_Y_RES)
+					colour = video_rgb + 3 * video_index;
+			}
+
+			float z = metric_depth;
+			float wx = (rays.col[0][x] + bx) * z;
+			float wy = (rays.col[1][x] + by) * z;
+			float wz = (rays.col[2][x] + bz) * z;
+			if (layout == FREENECT_POINTS_XYZRGB) {
+				freenect_point_xyzrgb* p = interleaved + n;
+				p->x = wx;
+				p->y = wy;
+				p->z = wz;
+				p->r = colour ? colour[0] : 0;
+				p->g = colour ? colour[1] : 0;
+				p->b = colour ? colour[2] : 0;
+				p->valid = colour ? 255 : 0;
+			} else {
+				xyz[3*n+0] = wx;
+				xyz[3*n+1] = wy;
+				xyz[3*n+2] = wz;
+				rgb[3*n+0] = colour ? colour[0] : 0;
+				rgb[3*n+1] = colour ? colour[1] : 0;
+				rgb[3*n+2] = colour ? colour[2] : 0;
+			}
+			n++;
+		}
+	}
+	return n;
+}
+
+// atan2 by minimax polynomial (max error ~1e-5 rad), branch-free so the
+// normals loops stay vectorizable
+static inline float fast_atan2f(float y, float x)
+{
+	float ax = fabsf(x), ay = fabsf(y);
+	float hi = ax > ay ? ax : ay;
+	float lo = ax > ay ? ay : ax;
+	float a = lo / (hi + FLT_MIN);
+	float s = a * a;
+	float r = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * a + a;
+	r = ay > ax ? 1.57079637f - r : r;
+	r = x < 0 ? 3.14159274f - r : r;
+	return y < 0 ? -r : r;
+}
+
+/// depth frame -> organized normals, slope and aspect
+int freenect_depth_to_normals(freenect_device* dev, const uint16_t* depth_mm,
+	float* normals, float* slope, float* aspect, int row_begin, int row_end)
+{
+	freenect_registration* reg = &(dev->registration);
+	// depth rows above, at and below the current one, with a one pixel border
+	// of "no depth" so the inner loop needs no edge cases
+	int32_t rows[3][DEPTH_X_RES + 2];
+	float ray_x[DEPTH_X_RES + 2];
+	float row_n[3][DEPTH_X_RES];
+	int x,y,i;
+
+	if (row_begin < 0) row_begin = 0;
+	if (row_end > DEPTH_Y_RES) row_end = DEPTH_Y_RES;
+	if (!reg->ray_x && freenect_init_ray_tables(reg) < 0)
+		return -1;
+
+	memcpy(ray_x + 1, reg->ray_x, DEPTH_X_RES * sizeof(float));
+	ray_x[0] = ray_x[DEPTH_X_RES + 1] = 0;
+
+	for (y = row_begin; y < row_end; y++) {
+		for (i = 0; i < 3; i++) {
+			int src_y = y + i - 1;
+			rows[i][0] = rows[i][DEPTH_X_RES + 1] = 0;
+			if (src_y < 0 || src_y >= DEPTH_Y_RES) {
+				memset(rows[i], 0, sizeof(rows[i]));
+				continue;
+			}
+			for (x = 0; x < DEPTH_X_RES; x++)
+				rows[i][x + 1] = depth_mm[src_y * DEPTH_X_RES + x];
+		}
+
+		const int32_t* up = rows[0];
+		const int32_t* mid = rows[1];
+		const int32_t* down = rows[2];
+		float ray_yc = reg->ray_y[y];
+		float ray_yu = y > 0 ? reg->ray_y[y - 1] : ray_yc;
+		float ray_yd = y < DEPTH_Y_RES - 1 ? reg->ray_y[y + 1] : ray_yc;
+
+		for (x = 1; x <= DEPTH_X_RES; x++) {
+			float zc = mid[x], zl = mid[x-1], zr = mid[x+1], zu = up[x], zd = down[x];
+			// a missing neighbour is replaced by the centre pixel, which turns the
+			// central difference into a one-sided one; the scale drops out when
+			// normalizing
+			zl = mid[x-1] > 0 ? zl : zc;
+			zr = mid[x+1] > 0 ? zr : zc;
+			zu = up[x] > 0 ? zu : zc;
+			zd = down[x] > 0 ? zd : zc;
+			float xl = mid[x-1] > 0 ? ray_x[x-1] : ray_x[x];
+			float xr = mid[x+1] > 0 ? ray_x[x+1] : ray_x[x];
+			float yu = up[x] > 0 ? ray_yu : ray_yc;
+			float yd = down[x] > 0 ? ray_yd : ray_yc;
+
+			// world space tangents along the image rows and columns
+			float dxx = xr * zr - xl * zl, dxy = ray_yc * (zr - zl), dxz = zr - zl;
+			float dyx = ray_x[x] * (zd - zu), dyy = yd * zd - yu * zu, dyz = zd - zu;
+
+			// down x right points towards the camera (-z)
+			float nx = dyy * dxz - dyz * dxy;
+			float ny = dyz * dxx - dyx * dxz;
+			float nz = dyx * dxy - dyy * dxx;
+			float len2 = nx * nx + ny * ny + nz * nz;
+
+			int valid = (mid[x] > 0) & ((mid[x-1] > 0) | (mid[x+1] > 0)) & ((up[x] > 0) | (down[x] > 0));
+			float inv = (valid ? 1.0f : 0.0f) / sqrtf(len2 + FLT_MIN);
+			row_n[0][x-1] = nx * inv;
+			row_n[1][x-1] = ny * inv;
+			row_n[2][x-1] = nz * inv;
+		}
+
+		// scatter the row into the requested outputs in separate passes, so none
+		// of the loops carry a branch
+		uint32_t offset = y * DEPTH_X_RES;
+		if (normals) {
+			float* out = normals + 3 * offset;
+			for (x = 0; x < DEPTH_X_RES; x++) {
+				out[3*x+0] = row_n[0][x];
+				out[3*x+1] = row_n[1][x];
+				out[3*x+2] = row_n[2][x];
+			}
+		}
+		if (slope) {
+			for (x = 0; x < DEPTH_X_RES; x++) {
+				float nx = row_n[0][x], ny = row_n[1][x], nz = row_n[2][x];
+				float tilt = fast_atan2f(sqrtf(nx * nx + ny * ny), -nz);
+				slope[offset + x] = (nx * nx + ny * ny + nz * nz) > 0 ? tilt : -1;
+			}
+		}
+		if (aspect) {
+			for (x = 0; x < DEPTH_X_RES; x++)
+				aspect[offset + x] = fast_atan2f(row_n[1][x], row_n[0][x]);
+		}
+	}
+	return 0;
+}
+
+/// depth -> 1280x1024 RGB mapping, the FREENECT_RESOLUTION_HIGH counterpart
+/// of freenect_apply_registration
+int freenect_map_depth_to_rgb_high(freenect_device* dev, const uint16_t* depth_mm, uint16_t* output_mm)
+{
+	freenect_registration* reg = &(dev->registration);
+
+	if (dev->video_resolution != FREENECT_RESOLUTION_HIGH)
+		return -1;
+	if (!reg->raw_to_mm_shift && freenect_init_registration(dev) < 0)
+		return -1;
+	if (!reg->registration_table_high) {
+		reg->registration_table_high = (int32_t (*)[2])malloc( sizeof( int32_t) * DEPTH_X_RES * DEPTH_Y_RES * 2 );
+		if (!reg->registration_table_high)
+			return -1;
+		freenect_init_registration_table( reg->registration_table_high, &(reg->reg_info), VIDEO_HIGH_SCALE );
+	}
+
+	size_t i, *wipe = (size_t*)output_mm;
+	for (i = 0; i < VIDEO_HIGH_X_RES * VIDEO_HIGH_Y_RES * sizeof(uint16_t) / sizeof(size_t); i++) wipe[i] = DEPTH_NO_MM_VALUE;
+
+	// pad lines are given in VGA rows
+	uint32_t start_row = VIDEO_HIGH_SCALE * reg->reg_pad_info.start_lines;
+	uint32_t x,y,index = 0;
+
+	// same scatter as the VGA path, walking the depth frame and its table
+	// linearly; each sample covers a 2x2 block since the target has four times
+	// the pixels of the source
+	for (y = 0; y < DEPTH_Y_RES; y++) {
+		for (x = 0; x < DEPTH_X_RES; x++, index++) {
+			uint16_t metric_depth = depth_mm[index];
+			if (metric_depth == DEPTH_NO_MM_VALUE) continue;
+			if (metric_depth >= DEPTH_MAX_METRIC_VALUE) continue;
+
+			uint32_t reg_index = DEPTH_MIRROR_X ? ((y + 1) * DEPTH_X_RES - x - 1) : index;
+			uint32_t nx = (reg->registration_table_high[reg_index][0] + VIDEO_HIGH_SCALE * reg->depth_to_rgb_shift[metric_depth]) / REG_X_VAL_SCALE;
+			uint32_t ny =  reg->registration_table_high[reg_index][1] - start_row;
+
+			if (nx >= VIDEO_HIGH_X_RES - 1 || ny >= VIDEO_HIGH_Y_RES - 1) continue;
+			if (DEPTH_MIRROR_X) nx = VIDEO_HIGH_X_RES - 2 - nx;
+
+			uint16_t* target = output_mm + ny * VIDEO_HIGH_X_RES + nx;
+			if (target[0] == DEPTH_NO_MM_VALUE || target[0] > metric_depth) target[0] = metric_depth;
+			if (target[1] == DEPTH_NO_MM_VALUE || target[1] > metric_depth) target[1] = metric_depth;
+			target += VIDEO_HIGH_X_RES;
+			if (target[0] == DEPTH_NO_MM_VALUE || target[0] > metric_depth) target[0] = metric_depth;
+			if (target[1] == DEPTH_NO_MM_VALUE || target[1] > metric_depth) target[1] = metric_depth;
+		}
+	}
+	return 0;
+}
+
 /// RGB -> depth mapping function (inverse of default FREENECT_DEPTH_REGISTERED mapping)
 void freenect_map_rgb_to_depth(freenect_device* dev, uint16_t* depth_mm, uint8_t* rgb_raw, uint8_t* rgb_registered)
 {
@@ -427,6 +908,9 @@ freenect_registration freenect_copy_registration(freenect_device* dev)
 	retval.raw_to_mm_shift    = (uint16_t*)malloc( sizeof(uint16_t) * DEPTH_MAX_RAW_VALUE );
 	retval.depth_to_rgb_shift = (int32_t*)malloc( sizeof( int32_t) * DEPTH_MAX_METRIC_VALUE );
 	retval.registration_table = (int32_t (*)[2])malloc( sizeof( int32_t) * DEPTH_X_RES * DEPTH_Y_RES * 2 );
+	retval.registration_table_high = NULL;
+	retval.ray_x = NULL;
+	retval.ray_y = NULL;
 	complete_tables(&retval);
 	return retval;
 }
@@ -445,5 +929,17 @@ int freenect_destroy_registration(freenect_registration* reg)
 		free(reg->registration_table);
 		reg->registration_table = NULL;
 	}
+	if (reg->registration_table_high) {
+		free(reg->registration_table_high);
+		reg->registration_table_high = NULL;
+	}
+	if (reg->ray_x) {
+		free(reg->ray_x);
+		reg->ray_x = NULL;
+	}
+	if (reg->ray_y) {
+		free(reg->ray_y);
+		reg->ray_y = NULL;
+	}
 	return 0;
 }
@@ -31,6 +31,7 @@
 #include <math.h>
 
 #include "freenect_internal.h"
+#include "registration.h"
 
 // The kinect can tilt from +31 to -31 degrees in what looks like 1 degree increments
 // The control input looks like 2*desired_degrees
@@ -144,6 +145,8 @@ int update_tilt_state_alt(freenect_device *dev){
         //this is multiplied by 2 as the older 1414 device reports angles doubled and freenect takes this into account
         dev->raw_state.tilt_angle       = (int8_t)accel_and_tilt.tilt * 2;
 
+        freenect_update_gravity(dev);
+
 	}
 	// Reply: skip four uint32_t, then you have three int32_t that give you acceleration in that direction, it seems.
 	// Units still to be worked out.
@@ -180,6 +183,7 @@ int freenect_update_tilt_state(freenect_device *dev)
 	dev->raw_state.accelerometer_z = (int16_t)uz;
 	dev->raw_state.tilt_angle = (int8_t)buf[8];
 	dev->raw_state.tilt_status = (freenect_tilt_status_code)buf[9];
+	freenect_update_gravity(dev);
 
 	return ret;
 }